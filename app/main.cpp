@@ -1,17 +1,215 @@
 #include <iostream>
+#include <memory>
+#include <sstream>
 #include <stdexcept>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+#include <csignal>
+#include <unistd.h>
 
 #include "runner.hpp"
+#include "mapped.hpp"
+#include "binary.hpp"
+#include "pipeline.hpp"
+#include "shards.hpp"
+#include "latency.hpp"
+#include "journal.hpp"
 
-int main(int , char** )
+namespace {
+    int usage(const char* name)
+    {
+        std::cerr << "Usage: " << name << " [-b] [-d | -l <N>] [-f event|input|idle|<N>] [-p spin|block [-c <cpu>,<cpu>,<cpu>] [-s <N> [-r <N>]]] [-t <base>,<tick>,<N>] [-j <journal>] [file]\n"
+                  << "  -b : binary input and output (see binary.hpp), only from standard input\n"
+                  << "  -d : write only changes to resting orders, rather than all orders\n"
+                  << "  -l : write only changed price levels, aggregated, of N best levels of each side or 0 for all\n"
+                  << "  -f : flush output after each record, before each input, when no input is\n"
+                  << "       available (default) or after every N records\n"
+                  << "  -p : read, match and write in separate threads, which busy spin or block when waiting\n"
+                  << "  -c : pin reader, engine and writer threads to cores, -1 to not pin\n"
+                  << "  -s : match instruments in N engine threads, each owning a share of instruments; then\n"
+                  << "       -c pins reader and writer, the first core and those following it the engine threads\n"
+                  << "  -r : move instruments between engine threads to balance their load, every N inputs\n"
+                  << "  -t : band of prices of each instrument, N levels one tick apart from base (default 0,1,65536),\n"
+                  << "       only if built with SMATCH_BOOK_LADDER, otherwise any price is accepted\n"
+                  << "  -j : append inputs to journal file, after recovering engines from inputs already in it\n"
+                  << "  file : read input from memory mapped file, rather than standard input\n"
+                  << "Each text input may end with the name of instrument, otherwise the default one is used" << std::endl;
+        return 1;
+    }
+
+    std::ostream none(nullptr);
+
+    // Run in the calling thread, or pipeline if not null, or shards if not null
+    template <typename In, typename Channel>
+    void run(smatch::MultiEngine& en, In& in, Channel& st, smatch::Runner::Output output,
+             const smatch::Pipeline* pipeline, const smatch::Shards* shards, smatch::Symbols* symbols)
+    {
+        if (pipeline == nullptr && shards == nullptr)
+            return smatch::Runner::run(en, in, st, output);
+
+        // Reading and writing are in different threads, so each needs its own channel
+        Channel rd(in, none, smatch::Flush::Idle, 1, symbols);
+        rd.journal = st.journal;
+        if (shards == nullptr)
+            return pipeline->run(en, rd, st, output);
+
+        std::vector<smatch::MultiEngine> engines(shards->shard_cpus.size());
+        for (auto& e : engines) {
+            e.depth(en.depth());
+            e.band(en.band());
+        }
+        // Engines recovered from journal go to the initial shards of their symbols
+        for (uint s = 0; s < en.size(); ++s)
+            engines[smatch::Shards::shard(s, engines.size())].adopt(s, en.release(s));
+        shards->run(engines, rd, st, output);
+    }
+}
+
+int main(int argc, char** argv)
 {
     using namespace smatch;
+    auto output = Runner::Output::Book;
+    auto flush = Flush::Idle;
+    size_t count = 1;
+    size_t depth = 0;
+    const char* path = nullptr;
+    const char* journal = nullptr;
+    bool binary = false;
+    Pipeline pipeline;
+    bool threads = false;
+    size_t engines = 0;
+    size_t rebalance = 0;
+    Band band;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-b") == 0)
+            binary = true;
+        else if (std::strcmp(argv[i], "-d") == 0)
+            output = Runner::Output::Delta;
+        else if (std::strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+            const std::string n = argv[++i];
+            if (n.empty() || n.find_first_not_of("0123456789") != std::string::npos || n.size() > 9)
+                return usage(argv[0]);
+            output = Runner::Output::Level;
+            depth = std::stoul(n);
+        }
+        else if (std::strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            const std::string f = argv[++i];
+            if (f == "event")
+                flush = Flush::Event;
+            else if (f == "input")
+                flush = Flush::Input;
+            else if (f == "idle")
+                flush = Flush::Idle;
+            else if (f.find_first_not_of("0123456789") == std::string::npos && f != "0") {
+                flush = Flush::Count;
+                count = std::stoul(f);
+            }
+            else
+                return usage(argv[0]);
+        }
+        else if (std::strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            const std::string p = argv[++i];
+            threads = true;
+            if (p == "spin")
+                pipeline.wait = Wait::Spin;
+            else if (p == "block")
+                pipeline.wait = Wait::Block;
+            else
+                return usage(argv[0]);
+        }
+        else if (std::strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            char sentinel;
+            if (std::sscanf(argv[++i], "%d,%d,%d%c", &pipeline.reader_cpu, &pipeline.engine_cpu,
+                            &pipeline.writer_cpu, &sentinel) != 3)
+                return usage(argv[0]);
+        }
+        else if (std::strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            const std::string n = argv[++i];
+            if (n.find_first_not_of("0123456789") != std::string::npos || n == "0" || n.size() > 4)
+                return usage(argv[0]);
+            engines = std::stoul(n);
+        }
+        else if (std::strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            const std::string n = argv[++i];
+            if (n.find_first_not_of("0123456789") != std::string::npos || n == "0" || n.size() > 9)
+                return usage(argv[0]);
+            rebalance = std::stoul(n);
+        }
+        else if (std::strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            // Each number is checked before it is stored, since sscanf would silently wrap large ones
+            std::istringstream t(argv[++i]);
+            std::string n;
+            uint64_t v[3];
+            size_t k = 0;
+            for (; k < 3 && std::getline(t, n, ','); ++k) {
+                if (n.empty() || n.find_first_not_of("0123456789") != std::string::npos || n.size() > 10)
+                    return usage(argv[0]);
+                v[k] = std::stoull(n);
+            }
+            if (k != 3 || not t.eof() || v[0] > UINT32_MAX || v[1] > UINT32_MAX)
+                return usage(argv[0]);
+            band = Band{static_cast<uint>(v[0]), static_cast<uint>(v[1]), static_cast<size_t>(v[2])};
+            if (not band.valid())
+                return usage(argv[0]);
+        }
+        else if (std::strcmp(argv[i], "-j") == 0 && i + 1 < argc && journal == nullptr)
+            journal = argv[++i];
+        else if (argv[i][0] != '-' && path == nullptr)
+            path = argv[i];
+        else
+            return usage(argv[0]);
+    }
+    if ((binary && path != nullptr) || (engines > 0 && not threads) || (rebalance > 0 && engines == 0))
+        return usage(argv[0]);
+
+    Shards shards;
+    shards.wait = pipeline.wait;
+    shards.rebalance = rebalance;
+    shards.reader_cpu = pipeline.reader_cpu;
+    shards.writer_cpu = pipeline.writer_cpu;
+    for (size_t i = 0; i < engines; ++i)
+        shards.shard_cpus.push_back(pipeline.engine_cpu < 0 ? -1 : pipeline.engine_cpu + static_cast<int>(i));
+
+    // Otherwise std::cin is unbuffered, and would always appear idle to Flush::Idle
+    std::ios::sync_with_stdio(false);
+    // If enabled at build time, percentiles of latency are written to standard error on SIGUSR1 and on exit
+    latency::dump_on(SIGUSR1);
     try {
-        Engine en;
-        Runner::run(en, std::cin, std::cout);
+        // Input with no symbol is for the default instrument, i.e. same as single instrument engine
+        MultiEngine en;
+        en.depth(depth);
+        en.band(band);
+        Symbols symbols;
+        const Pipeline* p = (threads ? &pipeline : nullptr);
+        const Shards* s = (engines > 0 ? &shards : nullptr);
+        // Recovered engines are in the state they were after the last input journaled, and output starts from there
+        std::unique_ptr<Journal> j;
+        if (journal != nullptr) {
+            j.reset(new Journal(journal));
+            j->recover(en, binary ? nullptr : &symbols);
+        }
+        if (binary) {
+            Journaled<BinaryStream> st(std::cin, std::cout, flush, count);
+            st.journal = j.get();
+            run(en, std::cin, st, output, p, s, nullptr);
+        }
+        else if (path != nullptr) {
+            Mapped in(path);
+            Journaled<MappedStream> st(in, std::cout, flush, count, &symbols);
+            st.journal = j.get();
+            run(en, in, st, output, p, s, &symbols);
+        }
+        else {
+            Journaled<Stream> st(std::cin, std::cout, flush, count, &symbols);
+            st.journal = j.get();
+            run(en, std::cin, st, output, p, s, &symbols);
+        }
     }
     catch (std::exception& e) {
         std::cerr << e.what() << std::endl;
         return 1;
     }
+    latency::dump(STDERR_FILENO);
 }
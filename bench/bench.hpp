@@ -0,0 +1,28 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+namespace bench {
+
+// Each benchmark is run as "bench <name> [arguments]", see main.cpp
+int book(int argc, char** argv);
+int flow(int argc, char** argv);
+int index(int argc, char** argv);
+int parse(int argc, char** argv);
+
+using clock = std::chrono::steady_clock;
+
+inline double nanos(clock::time_point start, clock::time_point stop, uint64_t count)
+{
+    return std::chrono::duration<double, std::nano>(stop - start).count() / (count ? count : 1);
+}
+
+// Prevent compiler from optimizing away computation of value
+template <typename T>
+inline void keep(const T& value)
+{
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+}
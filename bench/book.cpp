@@ -0,0 +1,122 @@
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "bench.hpp"
+#include "book.hpp"
+
+namespace {
+    using namespace smatch;
+
+    Order sell(uint id, uint price, uint size)
+    {
+        Order o {};
+        o.side = Side::Sell;
+        o.id = id;
+        o.price = price;
+        o.size = o.full = o.peak = size;
+        o.add = true;
+        return o;
+    }
+
+    // Deep book of sell orders, levels prices with orders each, inserted in random order so that nodes of
+    // neighbouring orders are not neighbours in memory. Then half of the orders are cancelled at random, and
+    // the rest is swept by aggressive buy orders, each filling a few resting orders.
+    void run(size_t levels, size_t orders)
+    {
+        const size_t count = levels * orders;
+        std::mt19937 gen(static_cast<uint>(count));
+        std::vector<Order> inputs;
+        inputs.reserve(count);
+        for (size_t i = 0; i < count; ++i)
+            inputs.push_back(sell(static_cast<uint>(i + 1), static_cast<uint>(1000 + i % levels), 10));
+        std::shuffle(inputs.begin(), inputs.end(), gen);
+
+        Book book;
+        book.reserve(count);
+        auto start = bench::clock::now();
+        for (const auto& o : inputs)
+            book.insert(o);
+        auto stop = bench::clock::now();
+        const double insert = bench::nanos(start, stop, count);
+
+        // Binary snapshot of the whole book, restored into a new one
+        std::stringstream snapshot;
+        start = bench::clock::now();
+        book.save(snapshot);
+        stop = bench::clock::now();
+        const double save = bench::nanos(start, stop, count);
+        double restore = 0;
+        {
+            Book restored;
+            start = bench::clock::now();
+            restored.restore(snapshot);
+            stop = bench::clock::now();
+            restore = bench::nanos(start, stop, count);
+            bench::keep(restored.ids().size());
+        }
+        snapshot.str(std::string());
+
+        std::vector<uint> victims(count / 2);
+        for (size_t i = 0; i < victims.size(); ++i)
+            victims[i] = inputs[i].id;
+        std::shuffle(victims.begin(), victims.end(), gen);
+        start = bench::clock::now();
+        for (const auto id : victims)
+            book.remove(id);
+        stop = bench::clock::now();
+        const double cancel = bench::nanos(start, stop, victims.size());
+
+        // Each aggressive order fills 4 resting orders, and may cross several price levels
+        std::vector<Match> matches;
+        uint id = static_cast<uint>(count);
+        size_t aggressive = 0;
+        size_t fills = 0;
+        start = bench::clock::now();
+        while (book.bbo().ask.count > 0) {
+            Order active {Side::Buy, ++id, 1000 + static_cast<uint>(levels), 40, 40, 40, true, 0};
+            matches.clear();
+            book.match<Side::Buy>(active, matches);
+            fills += matches.size();
+            ++aggressive;
+        }
+        stop = bench::clock::now();
+        const double match = bench::nanos(start, stop, fills);
+
+        std::cout << std::setw(10) << "" << std::setw(10) << levels << std::setw(10) << orders
+                  << std::fixed << std::setprecision(1)
+                  << std::setw(12) << insert
+                  << std::setw(12) << cancel
+                  << std::setw(12) << match
+                  << std::setw(12) << save
+                  << std::setw(12) << restore
+                  << std::setw(12) << book.pool().block() << std::endl;
+        bench::keep(aggressive);
+    }
+}
+
+namespace bench {
+
+int book(int argc, char** argv)
+{
+    const size_t levels = (argc > 0 ? std::stoul(argv[0]) : 10000);
+    std::vector<size_t> orders;
+    for (int i = 1; i < argc; ++i)
+        orders.push_back(std::stoul(argv[i]));
+    if (orders.empty())
+        orders = {10, 100, 1000};
+
+    std::cout << std::left << std::setw(10) << "ns/op" << std::right << std::setw(10) << "levels" << std::setw(10) << "orders"
+              << std::setw(12) << "insert" << std::setw(12) << "cancel" << std::setw(12) << "fill"
+              << std::setw(12) << "save" << std::setw(12) << "restore"
+              << std::setw(12) << "node" << std::endl;
+    for (const auto o : orders)
+        run(levels, o);
+    return 0;
+}
+
+}
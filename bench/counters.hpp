@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace bench {
+
+// Hardware performance counters of the calling thread, user space only, opened with perf_event_open as one group
+// so that all are read at once. Events which cannot be opened (e.g. no PMU in a virtual machine, or not permitted
+// by perf_event_paranoid) are skipped, and read as zero with available() false.
+class Counters
+{
+public:
+    enum Event { Cycles, Instructions, L1DMisses, LLCMisses, BranchMisses, events };
+
+    static const char* name(size_t e)
+    {
+        static const char* const names[events] = {"cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses"};
+        return names[e];
+    }
+
+    struct Values
+    {
+        uint64_t value[events] = {};
+    };
+
+    Counters()
+    {
+        for (size_t e = 0; e < events; ++e)
+            fds_[e] = -1;
+        for (size_t e = 0; e < events; ++e) {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.disabled = (leader_ < 0);
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP;
+            config(static_cast<Event>(e), attr);
+            fds_[e] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, leader_, 0));
+            if (fds_[e] < 0)
+                continue;
+            if (leader_ < 0)
+                leader_ = fds_[e];
+            order_.push_back(e);
+        }
+        if (leader_ >= 0) {
+            ioctl(leader_, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(leader_, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+    }
+
+    Counters(const Counters&) = delete;
+    Counters& operator=(const Counters&) = delete;
+
+    ~Counters()
+    {
+        for (size_t e = 0; e < events; ++e) {
+            if (fds_[e] >= 0)
+                close(fds_[e]);
+        }
+    }
+
+    bool available(size_t e) const { return fds_[e] >= 0; }
+    bool any() const { return leader_ >= 0; }
+
+    // Current values since construction, of all events in one read
+    void read(Values& v) const
+    {
+        if (leader_ < 0)
+            return;
+        uint64_t buffer[1 + events];
+        if (::read(leader_, buffer, sizeof(buffer)) < static_cast<ssize_t>(sizeof(uint64_t)))
+            return;
+        for (size_t i = 0; i < buffer[0] && i < order_.size(); ++i)
+            v.value[order_[i]] = buffer[1 + i];
+    }
+
+private:
+    int                 fds_[events];
+    int                 leader_ = -1;
+    std::vector<size_t> order_;     // Events in the order of values read from the group
+
+    static void config(Event e, perf_event_attr& attr)
+    {
+        const auto cache = [](uint64_t cache, uint64_t op, uint64_t result) {
+            return cache | (op << 8) | (result << 16);
+        };
+        switch (e) {
+            case Cycles:
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.config = PERF_COUNT_HW_CPU_CYCLES;
+                break;
+            case Instructions:
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+                break;
+            case L1DMisses:
+                attr.type = PERF_TYPE_HW_CACHE;
+                attr.config = cache(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS);
+                break;
+            case LLCMisses:
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.config = PERF_COUNT_HW_CACHE_MISSES;
+                break;
+            case BranchMisses:
+            default:
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+                break;
+        }
+    }
+};
+
+}
@@ -0,0 +1,316 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "bench.hpp"
+#include "counters.hpp"
+#include "engine.hpp"
+#include "input.hpp"
+#include "runner.hpp"
+#include "stream.hpp"
+
+namespace {
+    using namespace smatch;
+
+    // Parameters of synthetic order flow, set on command line as name=value
+    struct Flow
+    {
+        uint        seed = 1;
+        uint64_t    count = 1000000;    // Inputs
+        uint        market = 5;         // Percent of inputs which are market orders
+        uint        iceberg = 10;       // Percent of icebergs
+        uint        cancel = 30;        // Percent of cancels, the remaining inputs are limit orders
+        uint        cross = 10;         // Percent of limit orders and icebergs priced to cross the mid
+        uint        depth = 50;         // Passive orders are up to this many ticks away from mid
+        uint        drift = 5;          // Percent of inputs after which mid moves by one tick, up or down
+        std::string output = "delta";   // Output of Runner, book, delta or level
+        std::string csv;                // If set, hardware counters per operation are appended to this file
+        std::string label;              // First column of CSV, e.g. to tell builds apart
+
+        static constexpr uint mid = 100000; // Initial mid price
+
+        // Band of ladder book around mid, as far as prices can reach after mid drifts by one tick on every input,
+        // but not below zero
+        Band band() const
+        {
+            const uint width = static_cast<uint>(std::min(uint64_t(mid), count + depth));
+            return Band{mid - width, 1, 2 * size_t(width) + 1};
+        }
+
+        bool set(const char* arg)
+        {
+            const char* const eq = std::strchr(arg, '=');
+            if (eq == nullptr)
+                return false;
+            const std::string name(arg, eq);
+            const std::string value(eq + 1);
+            if (name == "output") {
+                output = value;
+                return output == "book" || output == "delta" || output == "level";
+            }
+            if (name == "csv" || name == "label") {
+                (name == "csv" ? csv : label) = value;
+                return not value.empty() && value.find(',') == std::string::npos;
+            }
+            // Digits only, as std::stoull would throw or accept a sign, and fields other than count are uint
+            if (value.empty() || value.find_first_not_of("0123456789") != std::string::npos || value.size() > 19)
+                return false;
+            const uint64_t v = std::stoull(value);
+            if (name != "count" && v > std::numeric_limits<uint>::max())
+                return false;
+            if (name == "seed") seed = static_cast<uint>(v);
+            else if (name == "count") count = v;
+            else if (name == "market") market = static_cast<uint>(v);
+            else if (name == "iceberg") iceberg = static_cast<uint>(v);
+            else if (name == "cancel") cancel = static_cast<uint>(v);
+            else if (name == "cross") cross = static_cast<uint>(v);
+            else if (name == "depth") depth = static_cast<uint>(v);
+            else if (name == "drift") drift = static_cast<uint>(v);
+            else return false;
+            return market + iceberg + cancel <= 100 && cross <= 100 && drift <= 100 && depth > 0 && depth < mid;
+        }
+
+        Runner::Output mode() const
+        {
+            return (output == "book" ? Runner::Output::Book
+                    : output == "level" ? Runner::Output::Level : Runner::Output::Delta);
+        }
+    };
+
+    // Text input for the flow. Cancels pick a random order added so far, which might have been filled already.
+    std::string generate(const Flow& f)
+    {
+        std::mt19937 rng(f.seed);
+        auto gen = [&rng]() { return static_cast<uint>(rng()); };
+        const auto percent = [&gen](uint p) { return gen() % 100 < p; };
+        std::vector<uint> ids;
+        std::string text;
+        text.reserve(f.count * 24);
+        char line[64];
+        uint mid = Flow::mid;
+        uint id = 0;
+        for (uint64_t i = 0; i < f.count; ++i) {
+            if (percent(f.drift))
+                mid = (gen() % 2 ? mid + 1 : mid - 1);
+
+            const uint r = gen() % 100;
+            const bool buy = gen() % 2;
+            const char side = (buy ? 'B' : 'S');
+            const uint offset = gen() % f.depth;
+            const uint price = (percent(f.cross) == buy ? mid + offset : mid - offset);
+            int n = 0;
+            if (r < f.cancel && not ids.empty()) {
+                const size_t victim = gen() % ids.size();
+                n = std::snprintf(line, sizeof(line), "C %u\n", ids[victim]);
+                ids[victim] = ids.back();
+                ids.pop_back();
+            }
+            else if (r < f.cancel + f.market) {
+                n = std::snprintf(line, sizeof(line), "M %c %u %u\n", side, ++id, 1 + gen() % 500);
+            }
+            else if (r < f.cancel + f.market + f.iceberg) {
+                const uint peak = 10 + gen() % 50;
+                n = std::snprintf(line, sizeof(line), "I %c %u %u %u %u\n", side, ++id, price, peak * (2 + gen() % 20), peak);
+                ids.push_back(id);
+            }
+            else {
+                n = std::snprintf(line, sizeof(line), "L %c %u %u %u\n", side, ++id, price, 1 + gen() % 100);
+                ids.push_back(id);
+            }
+            text.append(line, n);
+        }
+        return text;
+    }
+
+    // Latency of each input in nanoseconds, sorted in place
+    void print(const char* name, std::vector<uint64_t>& nanos, double total)
+    {
+        std::sort(nanos.begin(), nanos.end());
+        const auto at = [&nanos](double p) {
+            return (nanos.empty() ? 0 : nanos[std::min(nanos.size() - 1, static_cast<size_t>(p * nanos.size()))]);
+        };
+        std::cout << std::left << std::setw(20) << name << std::right
+                  << std::setw(12) << nanos.size()
+                  << std::fixed << std::setprecision(2)
+                  << std::setw(10) << nanos.size() * 1e3 / total
+                  << std::setw(10) << at(0.5)
+                  << std::setw(10) << at(0.99)
+                  << std::setw(10) << at(0.999)
+                  << std::setw(12) << (nanos.empty() ? 0 : nanos.back()) << std::endl;
+    }
+
+    uint64_t since(bench::clock::time_point start)
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(bench::clock::now() - start).count();
+    }
+
+    std::vector<Input> decode(const std::string& text)
+    {
+        std::istringstream in(text);
+        std::ostream none(nullptr);
+        Stream st(in, none);
+        std::vector<Input> inputs;
+        Input i;
+        for (Status status {}; st.read(i, status); status = Status{})
+            inputs.push_back(i);
+        return inputs;
+    }
+
+    // Matching of decoded inputs only
+    void engine(const std::vector<Input>& inputs, const Band& band)
+    {
+        Engine e(band);
+        Engine::matches_t m;
+        std::vector<uint64_t> nanos;
+        nanos.reserve(inputs.size());
+        const auto start = bench::clock::now();
+        for (const auto& i : inputs) {
+            const auto t = bench::clock::now();
+            Status status {};
+            bench::keep(i.handle(e, m, status));
+            nanos.push_back(since(t));
+        }
+        print("Engine", nanos, static_cast<double>(since(start)));
+    }
+
+    // Kinds of inputs, for hardware counters. Aggressive orders which refill a resting iceberg are counted as
+    // Refill rather than Match.
+    enum class Op { Insert, Cancel, Match, Refill };
+    constexpr size_t ops = 4;
+
+    Op kind(const Input& i, const Engine& e, const Engine::matches_t& m)
+    {
+        if (i.cancel() != nullptr)
+            return Op::Cancel;
+        if (m.empty())
+            return Op::Insert;
+        for (const auto& d : e.deltas()) {
+            if (d.change == Change::Refill)
+                return Op::Refill;
+        }
+        return Op::Match;
+    }
+
+    // Matching of decoded inputs as above, with counters read before and after each input. Averages per input of
+    // each kind are printed and appended to CSV file, with empty values for counters which are not available.
+    void counters(const std::vector<Input>& inputs, const Band& band, const std::string& path, const std::string& label)
+    {
+        bench::Counters c;
+        if (not c.any())
+            std::cerr << "No hardware counters available, see perf_event_paranoid" << std::endl;
+
+        Engine e(band);
+        e.record(true);
+        Engine::matches_t m;
+        bench::Counters::Values totals[ops];
+        uint64_t count[ops] = {};
+        bench::Counters::Values before, after;
+        for (const auto& i : inputs) {
+            Status status {};
+            c.read(before);
+            i.handle(e, m, status);
+            c.read(after);
+            const size_t op = static_cast<size_t>(kind(i, e, m));
+            ++count[op];
+            for (size_t v = 0; v < bench::Counters::events; ++v)
+                totals[op].value[v] += after.value[v] - before.value[v];
+        }
+
+        std::ifstream probe(path);
+        const bool header = (not probe || probe.peek() == std::ifstream::traits_type::eof());
+        probe.close();
+        std::ofstream csv(path, std::ios::app);
+        csv << std::fixed << std::setprecision(2);
+        if (header) {
+            csv << "label,op,count";
+            for (size_t v = 0; v < bench::Counters::events; ++v)
+                csv << ',' << bench::Counters::name(v);
+            csv << '\n';
+        }
+
+        static const char* const names[ops] = {"insert", "cancel", "match", "refill"};
+        std::cout << std::left << std::setw(20) << "per input" << std::right << std::setw(12) << "inputs";
+        for (size_t v = 0; v < bench::Counters::events; ++v)
+            std::cout << std::setw(15) << bench::Counters::name(v);
+        std::cout << std::endl;
+        for (size_t op = 0; op < ops; ++op) {
+            std::cout << std::left << std::setw(20) << names[op] << std::right << std::setw(12) << count[op];
+            csv << label << ',' << names[op] << ',' << count[op];
+            for (size_t v = 0; v < bench::Counters::events; ++v) {
+                const double avg = static_cast<double>(totals[op].value[v]) / (count[op] ? count[op] : 1);
+                std::cout << std::setw(15);
+                csv << ',';
+                if (c.available(v)) {
+                    std::cout << avg;
+                    csv << avg;
+                }
+                else
+                    std::cout << '-';
+            }
+            std::cout << std::endl;
+            csv << '\n';
+        }
+    }
+
+    // Reading of text input, matching and writing of text output, as in app
+    void runner(const std::string& text, const Band& band, Runner::Output output)
+    {
+        std::istringstream in(text);
+        std::ostream none(nullptr);
+        Stream st(in, none);
+        Engine e(band);
+        e.record(output != Runner::Output::Book);
+        std::vector<uint64_t> nanos;
+        const auto start = bench::clock::now();
+        Input i;
+        for (;;) {
+            const auto t = bench::clock::now();
+            Status status {};
+            if (not st.read(i, status))
+                break;
+            // Errors, e.g. cancels of orders filled already, are not reported
+            if (status.ok())
+                bench::keep(Runner::handle(i, e, st, output));
+            nanos.push_back(since(t));
+        }
+        print("Runner", nanos, static_cast<double>(since(start)));
+    }
+}
+
+namespace bench {
+
+int flow(int argc, char** argv)
+{
+    Flow f;
+    for (int i = 0; i < argc; ++i) {
+        if (not f.set(argv[i])) {
+            std::cerr << "Invalid parameter " << argv[i] << std::endl;
+            return 1;
+        }
+    }
+
+    const std::string text = generate(f);
+    const std::vector<Input> inputs = decode(text);
+    std::cout << std::left << std::setw(20) << "latency ns" << std::right
+              << std::setw(12) << "inputs"
+              << std::setw(10) << "M/s"
+              << std::setw(10) << "p50"
+              << std::setw(10) << "p99"
+              << std::setw(10) << "p99.9"
+              << std::setw(12) << "max" << std::endl;
+    engine(inputs, f.band());
+    runner(text, f.band(), f.mode());
+    if (not f.csv.empty())
+        counters(inputs, f.band(), f.csv, f.label);
+    return 0;
+}
+
+}
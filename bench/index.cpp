@@ -0,0 +1,112 @@
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "bench.hpp"
+#include "ids.hpp"
+#include "level.hpp"
+
+namespace {
+    using namespace smatch;
+
+    // Uniform interface over both containers
+    using map_t = std::unordered_map<uint, Node*>;
+    using index_t = IdIndex<Node*>;
+
+    bool insert(map_t& m, uint id, Node* n) { return m.emplace(id, n).second; }
+    bool insert(index_t& m, uint id, Node* n) { return m.emplace(id, n).second; }
+
+    Node* find(map_t& m, uint id) { const auto i = m.find(id); return i == m.end() ? nullptr : i->second; }
+    Node* find(index_t& m, uint id) { const auto i = m.find(id); return i == nullptr ? nullptr : *i; }
+
+    Node* extract(map_t& m, uint id)
+    {
+        const auto i = m.find(id);
+        if (i == m.end())
+            return nullptr;
+        Node* const n = i->second;
+        m.erase(i);
+        return n;
+    }
+    Node* extract(index_t& m, uint id) { Node* n = nullptr; m.extract(id, n); return n; }
+
+    // Live order ids are increasing with small random gaps, like ids assigned upstream with some
+    // orders filled immediately. Churn cancels a random live order and adds a new one, like steady
+    // state of a book.
+    template <typename Map>
+    void run(const char* name, size_t live)
+    {
+        std::mt19937 gen(live);
+        std::vector<uint> ids(live);
+        uint next = 0;
+        for (auto& id : ids)
+            id = (next += 1 + gen() % 4);
+
+        Map map;
+        map.reserve(live);
+        Node* const dummy = reinterpret_cast<Node*>(alignof(Node));
+
+        auto start = bench::clock::now();
+        for (const auto id : ids)
+            insert(map, id, dummy);
+        auto stop = bench::clock::now();
+        const double fill = bench::nanos(start, stop, live);
+
+        std::vector<uint> probe(live);
+        for (auto& id : probe)
+            id = ids[gen() % live];
+        start = bench::clock::now();
+        size_t hits = 0;
+        for (const auto id : probe)
+            hits += (find(map, id) != nullptr);
+        stop = bench::clock::now();
+        const double lookup = bench::nanos(start, stop, live);
+        bench::keep(hits);
+
+        std::vector<size_t> victims(live);
+        for (auto& v : victims)
+            v = gen() % live;
+        start = bench::clock::now();
+        for (const auto v : victims) {
+            bench::keep(extract(map, ids[v]));
+            ids[v] = (next += 1 + (v & 3));
+            insert(map, ids[v], dummy);
+        }
+        stop = bench::clock::now();
+        const double churn = bench::nanos(start, stop, live);
+
+        std::cout << std::left << std::setw(20) << name << std::right
+                  << std::setw(12) << live
+                  << std::fixed << std::setprecision(1)
+                  << std::setw(12) << fill
+                  << std::setw(12) << lookup
+                  << std::setw(16) << churn << std::endl;
+    }
+}
+
+namespace bench {
+
+int index(int argc, char** argv)
+{
+    std::vector<size_t> sizes;
+    for (int i = 0; i < argc; ++i)
+        sizes.push_back(std::stoul(argv[i]));
+    if (sizes.empty())
+        sizes = {1000000, 10000000};
+
+    std::cout << std::left << std::setw(20) << "ns/op" << std::right
+              << std::setw(12) << "live"
+              << std::setw(12) << "insert"
+              << std::setw(12) << "find"
+              << std::setw(16) << "cancel+insert" << std::endl;
+    for (const auto s : sizes) {
+        run<map_t>("std::unordered_map", s);
+        run<index_t>("IdIndex", s);
+    }
+    return 0;
+}
+
+}
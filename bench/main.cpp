@@ -0,0 +1,34 @@
+#include <iostream>
+#include <cstring>
+
+#include "bench.hpp"
+
+namespace {
+    struct Benchmark {
+        const char* name;
+        int (*run)(int, char**);
+        const char* help;
+    };
+
+    const Benchmark benchmarks[] = {
+        {"book", &bench::book, "[levels] [orders per level ...] : insert, cancel, fills and snapshot of a deep book"},
+        {"flow", &bench::flow, "[name=value ...] : latency of synthetic order flow, see Flow in flow.cpp"},
+        {"index", &bench::index, "[live orders ...] : order id index, IdIndex vs std::unordered_map"},
+        {"parse", &bench::parse, "[file] [GiB] : parsing of text input, file is generated if it does not exist"},
+    };
+}
+
+int main(int argc, char** argv)
+{
+    if (argc >= 2) {
+        for (const auto& b : benchmarks) {
+            if (std::strcmp(argv[1], b.name) == 0)
+                return b.run(argc - 2, argv + 2);
+        }
+    }
+
+    std::cerr << "Usage: " << argv[0] << " <benchmark> [arguments]" << std::endl;
+    for (const auto& b : benchmarks)
+        std::cerr << "  " << b.name << ' ' << b.help << std::endl;
+    return 1;
+}
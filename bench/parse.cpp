@@ -0,0 +1,201 @@
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "bench.hpp"
+#include "input.hpp"
+#include "stream.hpp"
+#include "mapped.hpp"
+#include "scan.hpp"
+
+namespace {
+    using namespace smatch;
+
+    // Write synthetic text input of at least this many bytes. Only well-formed inputs are generated.
+    void generate(const std::string& path, uint64_t bytes)
+    {
+        std::ofstream out(path, std::ios::binary);
+        std::mt19937 rng(1);
+        auto gen = [&rng]() { return static_cast<uint>(rng()); };
+        std::vector<char> buffer;
+        buffer.reserve(1 << 20);
+        char line[64];
+        uint64_t written = 0;
+        uint id = 0;
+        while (written < bytes) {
+            const auto r = gen() % 100;
+            const char side = (gen() % 2 ? 'B' : 'S');
+            const uint price = 9000 + gen() % 2000;
+            int n = 0;
+            ++id;
+            if (r < 40)
+                n = std::snprintf(line, sizeof(line), "L %c %u %u %u\n", side, id, price, 1 + gen() % 1000);
+            else if (r < 55)
+                n = std::snprintf(line, sizeof(line), "I %c %u %u %u %u\n", side, id, price, 1000 + gen() % 9000, 1 + gen() % 1000);
+            else if (r < 65)
+                n = std::snprintf(line, sizeof(line), "M %c %u %u\n", side, id, 1 + gen() % 1000);
+            else if (r < 70)
+                n = std::snprintf(line, sizeof(line), "O %c %u %u %u\n", side, id, price, 1 + gen() % 1000);
+            else
+                n = std::snprintf(line, sizeof(line), "C %u\n", 1 + gen() % id);
+            buffer.insert(buffer.end(), line, line + n);
+            if (buffer.size() > (1 << 20) - 64) {
+                out.write(buffer.data(), buffer.size());
+                written += buffer.size();
+                buffer.clear();
+            }
+        }
+        out.write(buffer.data(), buffer.size());
+    }
+
+    // Parsing implementation replaced by parse() in stream.cpp, for comparison
+    bool legacy(std::istream& in, Input& input)
+    {
+        std::string line;
+        if (not std::getline(in, line))
+            return false;
+        char dummy, side, sentinel;
+        Order o;
+        Cancel c;
+        switch (line[0]) {
+            case 'M':
+                if (std::sscanf(line.c_str(), "%c %c %u %u%c", &dummy, &side, &o.id, &o.size, &sentinel) != 4
+                    || not parse(o.side, side))
+                    throw bad_input("Ill-formed market order");
+                o.peak = o.full = o.size;
+                o.price = (o.side == Side::Buy ? std::numeric_limits<uint>::max() : 0);
+                input = Input(o);
+                break;
+            case 'O':
+            case 'L':
+                if (std::sscanf(line.c_str(), "%c %c %u %u %u%c", &dummy, &side, &o.id, &o.price, &o.size, &sentinel) != 5
+                    || not parse(o.side, side))
+                    throw bad_input("Ill-formed order");
+                o.peak = o.full = o.size;
+                input = Input(o);
+                break;
+            case 'I':
+                if (std::sscanf(line.c_str(), "%c %c %u %u %u %u%c", &dummy, &side, &o.id, &o.price, &o.full, &o.peak, &sentinel) != 6
+                    || not parse(o.side, side) || o.peak > o.full)
+                    throw bad_input("Ill-formed iceberg order");
+                o.size = o.peak;
+                input = Input(o);
+                break;
+            case 'C':
+                if (std::sscanf(line.c_str(), "%c %u%c", &dummy, &c.id, &sentinel) != 2)
+                    throw bad_input("Ill-formed cancel");
+                input = Input(c);
+                break;
+            default:
+                throw bad_input("Unrecognized input type");
+        }
+        return true;
+    }
+
+    void print(const char* name, uint64_t bytes, uint64_t count, double ns)
+    {
+        std::cout << std::left << std::setw(20) << name << std::right << std::fixed << std::setprecision(2)
+                  << std::setw(14) << count
+                  << std::setw(12) << bytes / ns << " GB/s"
+                  << std::setw(12) << count * 1e3 / ns << " M/s"
+                  << std::setw(10) << ns / count << " ns/line" << std::endl;
+    }
+
+    // Read all of input with given channel, count inputs
+    template <typename Channel, typename Read>
+    void run(const char* name, uint64_t bytes, Channel& ch, Read read)
+    {
+        Input i;
+        uint64_t count = 0;
+        const auto start = bench::clock::now();
+        while (read(ch, i))
+            ++count;
+        const auto stop = bench::clock::now();
+        bench::keep(i);
+        print(name, bytes, count, bench::nanos(start, stop, 1));
+    }
+
+    // Only find line ends in mapped input
+    void scan(const char* name, Kernel k, const Mapped& m)
+    {
+        uint32_t eols[LineScanner::batch];
+        uint64_t count = 0;
+        const auto start = bench::clock::now();
+        for (size_t from = 0; from < m.size(); ) {
+            const size_t size = std::min<size_t>(m.size() - from, std::numeric_limits<uint32_t>::max());
+            const size_t n = find_lines(k, m.data() + from, size, eols, LineScanner::batch);
+            count += n;
+            from = (n == LineScanner::batch ? from + eols[n - 1] + 1 : from + size);
+        }
+        const auto stop = bench::clock::now();
+        print(name, m.size(), count, bench::nanos(start, stop, 1));
+    }
+
+    // Find line ends and bounds of fields in mapped input
+    void scan_fields(const char* name, Kernel k, const Mapped& m)
+    {
+        uint32_t eols[LineScanner::batch], lasts[LineScanner::batch], bounds[LineScanner::batch_bounds];
+        uint64_t count = 0;
+        const auto start = bench::clock::now();
+        for (size_t from = 0; from < m.size(); ) {
+            const size_t size = std::min<size_t>(m.size() - from, std::numeric_limits<uint32_t>::max());
+            const size_t n = find_fields(k, m.data() + from, size, eols, lasts, LineScanner::batch,
+                                         bounds, LineScanner::batch_bounds);
+            count += n;
+            from = (n > 0 ? from + eols[n - 1] + 1 : from + size);
+        }
+        const auto stop = bench::clock::now();
+        print(name, m.size(), count, bench::nanos(start, stop, 1));
+    }
+}
+
+namespace bench {
+
+int parse(int argc, char** argv)
+{
+    const std::string path = (argc > 0 ? argv[0] : "bench_input.txt");
+    const double gib = (argc > 1 ? std::stod(argv[1]) : 2.0);
+
+    std::ifstream probe(path, std::ios::binary | std::ios::ate);
+    if (not probe) {
+        std::cout << "Generating " << gib << " GiB of input in " << path << std::endl;
+        generate(path, static_cast<uint64_t>(gib * (1 << 30)));
+        probe.open(path, std::ios::binary | std::ios::ate);
+    }
+    const uint64_t bytes = static_cast<uint64_t>(probe.tellg());
+
+    std::ostream none(nullptr);
+    {
+        Mapped m(path);
+        scan("find_lines scalar", Kernel::Scalar, m);
+        for (const auto k : {Kernel::SSE2, Kernel::AVX2}) {
+            if (supported(k))
+                scan(k == Kernel::SSE2 ? "find_lines sse2" : "find_lines avx2", k, m);
+        }
+        scan_fields("find_fields scalar", Kernel::Scalar, m);
+        for (const auto k : {Kernel::SSE2, Kernel::AVX2}) {
+            if (supported(k))
+                scan_fields(k == Kernel::SSE2 ? "find_fields sse2" : "find_fields avx2", k, m);
+        }
+
+        MappedStream st(m, none);
+        run("MappedStream::read", bytes, st, [](MappedStream& st, Input& i) { return st.read(i); });
+    }
+    {
+        std::ifstream in(path, std::ios::binary);
+        Stream st(in, none);
+        run("Stream::read", bytes, st, [](Stream& st, Input& i) { return st.read(i); });
+    }
+    {
+        std::ifstream in(path, std::ios::binary);
+        run("getline+sscanf", bytes, in, [](std::istream& in, Input& i) { return legacy(in, i); });
+    }
+    return 0;
+}
+
+}
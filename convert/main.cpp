@@ -0,0 +1,58 @@
+#include <fstream>
+#include <iostream>
+#include <cstring>
+
+#include "binary.hpp"
+#include "input.hpp"
+
+namespace {
+    int usage(const char* name)
+    {
+        std::cerr << "Usage: " << name << " [symbols] < text > binary\n"
+                  << "  Convert input from text to binary format, e.g. to replay existing inputs with app -b.\n"
+                  << "  Comments and empty lines are skipped, ill-formed lines are reported and skipped.\n"
+                  << "  Names of instruments are replaced with ids, which are written to symbols file if given." << std::endl;
+        return 1;
+    }
+
+    // Only reading is needed
+    std::ostream none(nullptr);
+}
+
+int main(int argc, char** argv)
+{
+    using namespace smatch;
+    if (argc > 2 || (argc == 2 && argv[1][0] == '-'))
+        return usage(argv[0]);
+
+    std::ios::sync_with_stdio(false);
+    Symbols symbols;
+    Stream st(std::cin, none, Flush::Idle, 1, &symbols);
+    Input i;
+    char msg[binary::message_size];
+    size_t line = 0;
+    for (;;) {
+        try {
+            ++line;
+            if (not st.read(i))
+                break;
+            if (i.empty())
+                continue;
+            binary::encode(i, msg);
+            std::cout.write(msg, sizeof(msg));
+        }
+        catch (const smatch::exception& e) {
+            std::cerr << "Line " << line << ": " << e.what() << std::endl;
+        }
+    }
+    std::cout.flush();
+
+    if (argc == 2) {
+        std::ofstream out(argv[1]);
+        for (uint id = 1; id < symbols.size(); ++id)
+            out << id << ' ' << symbols.name(id) << '\n';
+        if (not out)
+            return 1;
+    }
+    return std::cout ? 0 : 1;
+}
@@ -0,0 +1,192 @@
+#include "binary.hpp"
+#include "input.hpp"
+#include "latency.hpp"
+
+#include <limits>
+
+namespace smatch {
+
+namespace binary {
+
+namespace {
+    uint get32(const char* p)
+    {
+        const auto* u = reinterpret_cast<const unsigned char*>(p);
+        return static_cast<uint>(u[0]) | (static_cast<uint>(u[1]) << 8)
+             | (static_cast<uint>(u[2]) << 16) | (static_cast<uint>(u[3]) << 24);
+    }
+
+    void put32(char* p, uint v)
+    {
+        p[0] = static_cast<char>(v & 0xFF);
+        p[1] = static_cast<char>((v >> 8) & 0xFF);
+        p[2] = static_cast<char>((v >> 16) & 0xFF);
+        p[3] = static_cast<char>((v >> 24) & 0xFF);
+    }
+
+    // Both input messages and output records are 4 characters followed by symbol and 4 integers
+    void put(char* p, char c0, char c1, char c2, uint symbol, uint a, uint b, uint c, uint d)
+    {
+        p[0] = c0;
+        p[1] = c1;
+        p[2] = c2;
+        p[3] = 0;
+        put32(p + 4, symbol);
+        put32(p + 8, a);
+        put32(p + 12, b);
+        put32(p + 16, c);
+        put32(p + 20, d);
+    }
+}
+
+bool decode(const char* msg, Input& input, Status& status)
+{
+    const auto fail = [&](Error e) {
+        input = Input();
+        status = Status{e, 0};
+        return false;
+    };
+
+    const char type = msg[0];
+    const uint symbol = get32(msg + 4);
+    if (symbol >= max_symbols)
+        return fail(Error::InvalidSymbol);
+    if (type == 'C') {
+        if (msg[2] != 0 || msg[3] != 0)
+            return fail(Error::IllFormedCancel);
+        Cancel c;
+        c.symbol = symbol;
+        c.id = get32(msg + 8);
+        input = Input(c);
+        return true;
+    }
+
+    Order o;
+    if (msg[2] != 0 || msg[3] != 0 || not parse(o.side, msg[1]))
+        return fail(Error::IllFormedOrder);
+    o.symbol = symbol;
+    o.id = get32(msg + 8);
+    o.price = get32(msg + 12);
+    o.size = o.peak = o.full = get32(msg + 16);
+    switch (type) {
+        case 'M':
+            o.add = false;
+            if (o.side == Side::Buy)
+                o.price = std::numeric_limits<decltype(o.price)>::max();
+            else // if (o.side == Side::Sell)
+                o.price = std::numeric_limits<decltype(o.price)>::min();
+            break;
+        case 'O':
+            o.add = false;
+            break;
+        case 'L':
+            o.add = true;
+            break;
+        case 'I':
+            o.add = true;
+            o.size = o.peak = get32(msg + 20);
+            if (o.peak > o.full)
+                return fail(Error::IllFormedIceberg);
+            break;
+        default:
+            return fail(Error::UnrecognizedInput);
+    }
+    input = Input(o);
+    return true;
+}
+
+void decode(const char* msg, Input& input)
+{
+    Status status {};
+    if (not decode(msg, input, status))
+        raise(status);
+}
+
+void encode(const Input& input, char* msg)
+{
+    if (const Cancel* c = input.cancel()) {
+        put(msg, 'C', 0, 0, c->symbol, c->id, 0, 0, 0);
+        return;
+    }
+
+    const Order* o = input.order();
+    if (o == nullptr)
+        throw bad_input("Nothing to encode");
+    const uint market = (o->side == Side::Buy ? std::numeric_limits<uint>::max() : std::numeric_limits<uint>::min());
+    char type;
+    if (o->add)
+        type = (o->peak != o->full ? 'I' : 'L');
+    else
+        type = (o->price == market ? 'M' : 'O');
+    put(msg, type, static_cast<char>(o->side), 0, o->symbol, o->id, (type == 'M' ? 0 : o->price), o->full,
+        (type == 'I' ? o->peak : 0));
+}
+
+void encode(const Match& m, char* rec)
+{
+    put(rec, 'M', 0, 0, m.symbol, m.buyId, m.sellId, m.price, m.size);
+}
+
+void encode(const Order& o, char* rec)
+{
+    put(rec, 'O', 0, static_cast<char>(o.side), o.symbol, o.id, o.price, o.size, 0);
+}
+
+void encode(const Delta& d, char* rec)
+{
+    put(rec, 'D', static_cast<char>(d.change), static_cast<char>(d.side), d.symbol, d.id, d.price, d.size, 0);
+}
+
+void encode(const PriceLevel& l, char* rec)
+{
+    put(rec, 'P', 0, static_cast<char>(l.side), l.symbol, l.price, l.count, static_cast<uint>(l.size & 0xFFFFFFFF),
+        static_cast<uint>(l.size >> 32));
+}
+
+}
+
+bool BinaryStream::read(Input& input, Status& status)
+{
+    auto* const sb = in.rdbuf();
+    // Input boundary, also pass whether reading next input might block
+    writer.input(sb->in_avail() <= 0);
+
+    char msg[binary::message_size];
+    const auto n = sb->sgetn(msg, sizeof(msg));
+    latency::stage(latency::Stage::Wait);
+    if (n == 0) {
+        writer.flush();
+        return false; // EOF
+    }
+    if (n != sizeof(msg)) {
+        input = Input();
+        status = Status{Error::TruncatedMessage, 0};
+        return true;
+    }
+
+    binary::decode(msg, input, status);
+    return true;
+}
+
+bool BinaryStream::read(Input& input)
+{
+    Status status {};
+    const bool ret = read(input, status);
+    if (not status.ok())
+        raise(status);
+    return ret;
+}
+
+bool BinaryStream::report(const exception& e, bool)
+{
+    smatch::report(e);
+    return true;
+}
+
+bool BinaryStream::report(const Status& s)
+{
+    smatch::report(s);
+    return true;
+}
+
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "types.hpp"
+#include "writer.hpp"
+#include "stream.hpp"
+#include "symbols.hpp"
+
+#include <iostream>
+#include <cstddef>
+#include <cstdint>
+
+namespace smatch {
+
+// Fixed size binary messages, alternative to the text format read by Stream. All integers are little-endian.
+//
+// Input message, 24 bytes:
+//   0  char    type    'L' limit, 'M' market, 'O' immediate or cancel, 'I' iceberg, 'C' cancel
+//   1  char    side    'B' or 'S', ignored for cancel
+//   2  2 bytes         reserved, must be zero
+//   4  uint32  symbol  instrument, as interned by Symbols, below binary::max_symbols
+//   8  uint32  id
+//   12 uint32  price   ignored for market and cancel
+//   16 uint32  size    full size of iceberg, ignored for cancel
+//   20 uint32  peak    only for iceberg
+//
+// Output record, 24 bytes:
+//   0  char    type    'M' match, 'O' order, 'D' change of resting order, 'P' price level
+//   1  char    change  for 'D' only, as in Change, otherwise zero
+//   2  char    side    for 'O', 'D' and 'P' only, otherwise zero
+//   3  1 byte          reserved, zero
+//   4  uint32  symbol
+//   8  uint32  buy id for 'M', price for 'P', otherwise order id
+//   12 uint32  sell id for 'M', count for 'P', otherwise price
+//   16 uint32  price for 'M', otherwise (visible) size, which is uint64 taking both fields for 'P'
+//   20 uint32  size for 'M', otherwise zero
+namespace binary {
+    constexpr size_t message_size = 24;
+    constexpr size_t record_size = 24;
+
+    // Engines are indexed by symbol, so larger ids would make them allocate up to this id
+    constexpr size_t max_symbols = Symbols::default_capacity;
+
+    // Returns false and sets status if the message is ill-formed, and then input is empty
+    bool decode(const char* msg, Input& input, Status& status);
+
+    // As above, but throws bad_input
+    void decode(const char* msg, Input& input);
+
+    // Message equivalent to order or cancel, as it was decoded or parsed from text
+    void encode(const Input& input, char* msg);
+
+    void encode(const Match& m, char* rec);
+    void encode(const Order& o, char* rec);
+    void encode(const Delta& d, char* rec);
+    void encode(const PriceLevel& l, char* rec);
+}
+
+struct BinaryStream
+{
+    std::istream& in;
+    std::ostream& out;
+    Writer writer;
+
+    // Binary messages carry ids of symbols rather than names, so symbols are ignored. This parameter is only here
+    // so that BinaryStream can be constructed the same way as text channels.
+    BinaryStream(std::istream& in, std::ostream& out, Flush flush = Flush::Idle, size_t count = 1, Symbols* = nullptr)
+        : in(in), out(out), writer(out, flush, count)
+    { }
+
+    // As in Stream
+    bool read(Input&, Status& status);
+    bool read(Input&);
+
+    template <typename T>
+    void write(const T& v)
+    {
+        char rec[binary::record_size];
+        binary::encode(v, rec);
+        writer.begin().put(rec, sizeof(rec)).done();
+    }
+
+    bool report(const exception& e, bool);
+    bool report(const Status& s);
+};
+
+// There is no way to tell binary input from text by the type of istream, so the caller must construct BinaryStream
+inline BinaryStream& channel(std::istream&, BinaryStream& st)
+{
+    return st;
+}
+
+}
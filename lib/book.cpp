@@ -1,132 +1,402 @@
 #include "book.hpp"
 
 #include <algorithm>
+#include <cstring>
+#include <istream>
+#include <ostream>
 
 namespace smatch {
 
 namespace {
-    // Special value for Order.match, set at the end of Book::insert(). 0 is not good because the
-    // purpose of Order.match is to identify index of Match in vector passed to Book::match(), and
-    // of course first match added to this collection will have index 0
-    static constexpr size_t unmatched = std::numeric_limits<size_t>::max();
+    constexpr char magic[4] = {'S', 'M', 'B', 'K'};
+    constexpr size_t header_size = 48;
+    constexpr size_t level_size = 8;
+    constexpr size_t order_size = 28;
+    constexpr size_t block_size = 64 * 1024;
+    // Orders reserved up front when restoring, before counts in the header are confirmed by orders read
+    constexpr uint64_t reserve_limit = 1 << 20;
+
+    void put32(char* p, uint v)
+    {
+        for (int i = 0; i < 4; ++i, v >>= 8)
+            p[i] = static_cast<char>(v & 0xFF);
+    }
+
+    void put64(char* p, uint64_t v)
+    {
+        for (int i = 0; i < 8; ++i, v >>= 8)
+            p[i] = static_cast<char>(v & 0xFF);
+    }
+
+    uint get32(const char* p)
+    {
+        const auto* u = reinterpret_cast<const unsigned char*>(p);
+        return static_cast<uint>(u[0]) | (static_cast<uint>(u[1]) << 8)
+             | (static_cast<uint>(u[2]) << 16) | (static_cast<uint>(u[3]) << 24);
+    }
+
+    uint64_t get64(const char* p)
+    {
+        return get32(p) | (static_cast<uint64_t>(get32(p + 4)) << 32);
+    }
+
+    // Snapshot is written in blocks, rather than field by field through the stream
+    class SnapshotWriter
+    {
+        std::ostream&       out_;
+        std::vector<char>   buffer_;
+        size_t              size_;
+
+    public:
+        explicit SnapshotWriter(std::ostream& out) : out_(out), buffer_(block_size), size_(0)
+        { }
+
+        // Room for next size bytes, which must be written before the next call
+        char* next(size_t size)
+        {
+            if (size_ + size > buffer_.size())
+                flush();
+            char* const p = &buffer_[size_];
+            size_ += size;
+            return p;
+        }
+
+        void flush()
+        {
+            if (size_ > 0 && not out_.write(buffer_.data(), static_cast<std::streamsize>(size_)))
+                throw exception("Cannot write book snapshot");
+            size_ = 0;
+        }
+    };
+
+    // Reads no more than remaining bytes, which are known from the header, so that the stream can be used after
+    // the snapshot e.g. for snapshots of other books
+    class SnapshotReader
+    {
+        std::istream&       in_;
+        std::vector<char>   buffer_;
+        size_t              head_;
+        size_t              tail_;
+        uint64_t            remaining_;
+
+    public:
+        SnapshotReader(std::istream& in, uint64_t remaining)
+            : in_(in), buffer_(block_size), head_(0), tail_(0), remaining_(remaining)
+        { }
+
+        void expect(uint64_t remaining) { remaining_ = remaining; }
+
+        // Next size bytes, valid until the next call
+        const char* next(size_t size)
+        {
+            if (tail_ - head_ < size) {
+                std::memmove(buffer_.data(), &buffer_[head_], tail_ - head_);
+                tail_ -= head_;
+                head_ = 0;
+                const size_t read = static_cast<size_t>(std::min<uint64_t>(buffer_.size() - tail_, remaining_));
+                in_.read(&buffer_[tail_], static_cast<std::streamsize>(read));
+                tail_ += static_cast<size_t>(in_.gcount());
+                remaining_ -= static_cast<size_t>(in_.gcount());
+                if (tail_ < size)
+                    throw exception("Truncated book snapshot");
+            }
+            const char* const p = &buffer_[head_];
+            head_ += size;
+            return p;
+        }
+    };
+
+    struct Counts
+    {
+        uint64_t levels;
+        uint64_t orders;
+    };
+
+    template <typename Orders>
+    Counts counts(const Orders& orders)
+    {
+        Counts c {0, orders.size()};
+        for (const Level* l = orders.best(); l != nullptr; l = l->next)
+            ++c.levels;
+        return c;
+    }
+
+    template <typename Orders>
+    void save(const Orders& orders, SnapshotWriter& out)
+    {
+        for (const Level* l = orders.best(); l != nullptr; l = l->next) {
+            char* const p = out.next(level_size);
+            put32(p, l->price);
+            put32(p + 4, l->count);
+            for (const Node* n = l->head; n != nullptr; n = n->next) {
+                char* const o = out.next(order_size);
+                const Resting& r = n->second;
+                put64(o, n->first.serial);
+                put32(o + 8, r.id);
+                put32(o + 12, r.size);
+                put32(o + 16, r.full);
+                put32(o + 20, r.peak);
+                put32(o + 24, r.symbol);
+            }
+        }
+    }
+
+    // Levels are appended in order of prices, and orders in order of serial, which this checks as it goes
+    template <Side side, typename Orders>
+    void restore(SnapshotReader& in, const Counts& c, uint64_t serial, Orders& orders)
+    {
+        Level* prev = nullptr;
+        uint64_t left = c.orders;
+        for (uint64_t level = 0; level < c.levels; ++level) {
+            const char* const p = in.next(level_size);
+            const uint price = get32(p);
+            const uint count = get32(p + 4);
+            if (count == 0 || count > left)
+                throw exception("Inconsistent count of orders in book snapshot");
+            if (prev != nullptr && (side == Side::Buy ? price >= prev->price : price <= prev->price))
+                throw exception("Price levels out of order in book snapshot");
+            left -= count;
+
+            // Level is appended with its first order, so that a level is never left empty if a later check fails
+            Level* l = nullptr;
+            uint64_t last = 0;
+            for (uint i = 0; i < count; ++i) {
+                const char* const o = in.next(order_size);
+                const uint64_t s = get64(o);
+                const Resting r {side, get32(o + 8), price, get32(o + 12), get32(o + 16), get32(o + 20),
+                                 get32(o + 24)};
+                if (s <= last || s > serial)
+                    throw exception("Orders out of priority in book snapshot");
+                // Peak is above full size once an order is filled past its last refill, but never below size
+                if (r.size == 0 || r.size > r.full || r.size > r.peak)
+                    throw exception("Invalid size of order in book snapshot");
+                last = s;
+                if (l == nullptr)
+                    l = &orders.append(price, prev);
+                orders.append(*l, s, r);
+            }
+            prev = l;
+        }
+        if (left != 0)
+            throw exception("Inconsistent count of orders in book snapshot");
+    }
+
+    // Index is built once all orders are in place, walking their nodes in order of allocation and prefetching
+    // slots of ids a few orders ahead
+    template <typename Orders>
+    void index(Orders& orders, IdIndex<Node*>& ids)
+    {
+        constexpr size_t ahead = 16;
+        auto next = orders.begin();
+        for (size_t i = 0; i < ahead && next != orders.end(); ++i, ++next)
+            ids.prefetch(next->second.id);
+        for (auto it = orders.begin(); it != orders.end(); ++it) {
+            if (next != orders.end()) {
+                ids.prefetch(next->second.id);
+                ++next;
+            }
+            if (not ids.emplace(it->second.id, &*it).second)
+                throw exception("Duplicate order id in book snapshot");
+        }
+    }
 }
 
-Order& Book::insert(const Order& o)
+template <template <Side> class Orders>
+Resting& BasicBook<Orders>::insert(const Order& o)
 {
-    // BuySell is what we store in ids_, to allow us to quickly find orders by id
-    const auto it = ids_.emplace(
-        o.id , BuySell { buys_.end() , sells_.end() }
-    );
+    // Node of the order is what we store in ids_, to allow us to quickly find orders by id
+    const auto it = ids_.emplace(o.id , nullptr);
 
     // Enforce that ids are unique
     if (not it.second)
-        throw bad_order_id("Duplicate order id", o.id);
+        raise(Status{Error::DuplicateOrderId, o.id});
 
-    // A shortcut for storing buy or sell iterator into BuySell we just inserted into ids_
-    auto& os = it.first->second;
-
-    // Build Priority for price and priority of the order. Since on each insert
-    // we bump serial_, each such constructed Priority will be unique.
-    const Priority pp { o.price , ++serial_ };
+    // Priority of the order within its price level. Since on each insert we bump serial_, it will be unique.
+    const uint64_t serial = ++serial_;
 
     // Store an order (limit or iceberg) in an appropriate collection buys_ or sells_
-    // and persist the iterator for this element in BuySell created above.
-    Order* ret = nullptr;
-    if (o.side == Side::Buy) {
-        os.buy = buys_.emplace(pp, o).first;
-        ret = &os.buy->second;
+    // and persist its node in ids_, in the element created above.
+    // If this fails (e.g. price outside of Ladder band) make sure we do not leave orphaned entry in ids_
+    Node* n = nullptr;
+    try {
+        if (o.side == Side::Buy)
+            n = buys_.emplace(serial, o);
+        else
+            n = sells_.emplace(serial, o);
     }
-    else {
-        os.sell = sells_.emplace(pp, o).first;
-        ret = &os.sell->second;
+    catch (...) {
+        ids_.erase(o.id);
+        throw;
     }
-    ret->match = unmatched;
-    return *ret;
+
+    *it.first = n;
+    record(Change::Add, n->second);
+    return n->second;
 }
 
-void Book::remove(uint id)
+template <template <Side> class Orders>
+bool BasicBook<Orders>::remove(uint id, Status& status)
 {
-    const auto i = ids_.find(id);
-    if (i == ids_.end())
-        throw bad_order_id("Invalid order id", id);
+    Node* n = nullptr;
+    if (not ids_.extract(id, n)) {
+        status = Status{Error::InvalidOrderId, id};
+        return false;
+    }
 
-    if (i->second.buy != buys_.end())
-        buys_.erase(i->second.buy);
-    else // if (i->second.sell != sells_.end() )
-        sells_.erase(i->second.sell);
+    record(Change::Remove, n->second);
 
-    ids_.erase(i);
+    // Unlink from the price level, which might also remove the level if it was the last order there
+    if (n->second.side == Side::Buy)
+        buys_.erase(n);
+    else
+        sells_.erase(n);
+    return true;
 }
 
+template <template <Side> class Orders>
 template <Side side>
-void Book::match(Order& active, std::vector<Match>& matches)
+void BasicBook<Orders>::match(Order& active, std::vector<Match>& matches)
 {
     // Active order is on "this side" and it will be matched against orders on the "opposite side"
     constexpr auto opposite = (side == Side::Buy ? Side::Sell : Side::Buy);
-    auto& orders = this->orders<opposite>();
-    size_t count = 0; // Partially matched orders
+    auto& orders = this->template orders<opposite>();
+    // Each resting order filled gets one Match, after first. Orders with serial above this were refilled by this
+    // match, so they have been filled already, and refilled_ has the index of their Match.
+    const uint64_t serial = serial_;
+    const size_t first = matches.size();
+    const auto resting = [](const Match& m) { return (side == Side::Buy ? m.sellId : m.buyId); };
+    refilled_.clear();
     while (active.size > 0 && not orders.empty())
     {
-        auto& top = orders.begin()->second;
+        auto& node = *orders.begin();
+        auto& top = node.second;
         if (side == Side::Buy && active.price < top.price)
             break;
         else if (side == Side::Sell && active.price > top.price)
             break;
 
         const uint size = std::min(active.size, top.size);
-        if (top.match == unmatched)
+        size_t i; // Index of Match of top order
+        if (node.first.serial > serial)
         {
-            ++count;
+            // Fills of an iceberg refilled by this match are merged into its Match, which is not the last one if
+            // other orders at the same price were matched since
+            i = refilled_[node.first.serial - serial - 1];
+            matches[i].size += size;
+        }
+        else if (matches.size() > first && resting(matches.back()) == top.id)
+        {
+            // Top order is matched again by an iceberg active order, once its visible size is refilled
+            i = matches.size() - 1;
+            matches[i].size += size;
+        }
+        else
+        {
+            i = matches.size();
             Match match;
             match.price = top.price;
-            match.size = 0; // Increased below
+            match.size = size;
             match.buyId = (side == Side::Buy ? active.id : top.id);
             match.sellId = (side == Side::Sell ? active.id : top.id);
-            top.match = matches.size();
+            match.symbol = active.symbol;
             matches.push_back(match);
         }
-        matches[top.match].size += size;
 
         // Remove liquidity from active order, reset size if it is an iceberg
         active.full -= size;
         active.size = std::min(active.full, active.peak);
 
-        // Remove liquidity from top order
+        // Remove liquidity from top order, and from aggregate of its price level
         top.size -= size;
         top.full -= size;
+        node.level->size -= size;
 
-        // This section could be slightly optimized by replacing calls to remove() and insert()
-        // with custom tailored modifications of both ids_ and orders collections
-        if (top.size == 0)
+        // Iceberg with remaining hidden liquidity is refilled and moves to the back of its price level,
+        // keeping its node and entry in ids_. Otherwise fully matched order is removed.
+        if (top.size > 0)
+            record(Change::Reduce, top);
+        else if (top.full > 0)
+        {
+            orders.refill(&node, std::min(top.full, top.peak), ++serial_);
+            refilled_.push_back(i);
+            record(Change::Refill, top);
+        }
+        else
         {
-            const Order copy = top;
-            remove(copy.id);
+            remove(top.id);
             // Must not use top below this point
-            if (copy.full > 0)
-            {
-                auto& renew = insert(copy);
-                renew.match = copy.match;
-                renew.size = std::min(copy.full, copy.peak);
-            }
-            else
-                --count;
         }
     }
+}
 
-    // Clear partial matches collected so far
-    size_t i = 0;
-    for (auto& o : orders)
-    {
-        if (o.second.match == unmatched)
-            continue;
-        o.second.match = unmatched;
-        if (++i == count)
-            break;
+template <template <Side> class Orders>
+void BasicBook<Orders>::save(std::ostream& out) const
+{
+    const Counts buys = counts(buys_);
+    const Counts sells = counts(sells_);
+    SnapshotWriter o(out);
+    char* const h = o.next(header_size);
+    std::memcpy(h, magic, sizeof(magic));
+    put32(h + 4, snapshot_version);
+    put64(h + 8, serial_);
+    put64(h + 16, buys.levels);
+    put64(h + 24, buys.orders);
+    put64(h + 32, sells.levels);
+    put64(h + 40, sells.orders);
+    smatch::save(buys_, o);
+    smatch::save(sells_, o);
+    o.flush();
+}
+
+template <template <Side> class Orders>
+void BasicBook<Orders>::restore(std::istream& in)
+{
+    if (not buys_.empty() || not sells_.empty())
+        throw exception("Book must be empty to restore snapshot");
+
+    SnapshotReader i(in, header_size);
+    const char* const h = i.next(header_size);
+    if (std::memcmp(h, magic, sizeof(magic)) != 0)
+        throw exception("Not a book snapshot");
+    if (get32(h + 4) != snapshot_version)
+        throw exception("Unsupported version of book snapshot");
+    const uint64_t serial = get64(h + 8);
+    const Counts buys {get64(h + 16), get64(h + 24)};
+    const Counts sells {get64(h + 32), get64(h + 40)};
+    // Each level has at least one order
+    if (buys.levels > buys.orders || sells.levels > sells.orders || buys.orders > UINT32_MAX
+        || sells.orders > UINT32_MAX - buys.orders)
+        throw exception("Inconsistent count of orders in book snapshot");
+    i.expect((buys.levels + sells.levels) * level_size + (buys.orders + sells.orders) * order_size);
+
+    try {
+        // Counts of a corrupt or truncated snapshot must not allocate memory for orders it does not have. The pool
+        // grows past this limit as orders are read, and the index is sized once they all have been.
+        pool_.reserve(static_cast<size_t>(std::min(buys.orders + sells.orders, reserve_limit)));
+        smatch::restore<Side::Buy>(i, buys, serial, buys_);
+        smatch::restore<Side::Sell>(i, sells, serial, sells_);
+        ids_.reserve(static_cast<size_t>(buys.orders + sells.orders));
+        index(buys_, ids_);
+        index(sells_, ids_);
+        serial_ = serial;
+    }
+    catch (...) {
+        while (not buys_.empty())
+            buys_.erase(&*buys_.begin());
+        while (not sells_.empty())
+            sells_.erase(&*sells_.begin());
+        ids_ = IdIndex<Node*>();
+        throw;
     }
 }
 
 // Explicit instantiations of the above, for Engine::handle() to use
-template void Book::match<Side::Buy>(Order&, std::vector<Match>& );
-template void Book::match<Side::Sell>(Order&, std::vector<Match>& );
+template class BasicBook<Map>;
+template void BasicBook<Map>::match<Side::Buy>(Order&, std::vector<Match>& );
+template void BasicBook<Map>::match<Side::Sell>(Order&, std::vector<Match>& );
+
+template class BasicBook<Ladder>;
+template void BasicBook<Ladder>::match<Side::Buy>(Order&, std::vector<Match>& );
+template void BasicBook<Ladder>::match<Side::Sell>(Order&, std::vector<Match>& );
 
 }
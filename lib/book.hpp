@@ -1,99 +1,182 @@
 #pragma once
 
 #include "types.hpp"
+#include "level.hpp"
+#include "map.hpp"
+#include "ladder.hpp"
+#include "pool.hpp"
+#include "ids.hpp"
 
-#include <map>
-#include <unordered_map>
+#include <iosfwd>
 #include <vector>
 #include <cstdint>
+#include <type_traits>
 
 namespace smatch {
 
-struct bad_order_id : smatch::exception
+// Book is parametrized by the ordered collection used to store orders of each side. This can be either Map
+// (see map.hpp) or Ladder (see ladder.hpp), the latter only accepting prices in a band set when constructed.
+// Both keep orders of each price level in an intrusive FIFO queue (see level.hpp).
+template <template <Side> class Orders>
+class BasicBook
 {
-    const uint id;
-
-    bad_order_id(const char* sz , uint id) : exception(sz) , id(id)
-    { }
-};
-
-class Book
-{
-    // For storing orders in an ordered collection, prioritized by price and order received
-    struct Priority {
-        uint price;
-        uint64_t serial; // Order serial, used to prioritize orders by order received (if price same)
-    };
-
-    // For sorting of orders specific to side
-    template <Side>
-    struct Sort {
-        // Since specializations can only be implemented in namespace scope, scroll to bottom
-        inline constexpr bool operator()(Priority lh, Priority rh);
-    };
-
+public:
     // Two distinct types to store buy and sell orders, because different sort order
-    template <Side side> using orders_t = std::map<Priority, Order, Sort<side>>;
+    template <Side side> using orders_t = Orders<side>;
     using buys_t = orders_t<Side::Buy>;
     using sells_t = orders_t<Side::Sell>;
 
-    // This structure is to aid finding an order in buys_ or sells_, given an id. We can simply store
-    // iterators because these are never invalidated by ordinary operations we do on a map, like insert
-    // or erase (of an unrelated element). Only one of these two is ever set, the other is "end" one.
-    struct BuySell {
-        orders_t<Side::Buy>::iterator buy;
-        orders_t<Side::Sell>::iterator sell;
-    };
+private:
+    // Memory for nodes of orders in both buys_ and sells_. Must be declared before these containers, so
+    // it is destroyed after them.
+    Pool                                pool_;
 
     buys_t                              buys_;
     sells_t                             sells_;
-    std::unordered_map<uint, BuySell>   ids_;
+
+    // To aid finding an order in buys_ or sells_, given an id. Nodes are never moved once inserted, and
+    // their side is stored in the order itself.
+    IdIndex<Node*>                      ids_;
+
+    // If set, changes to resting orders are appended here
+    std::vector<Delta>*                 deltas_;
 
     // For sorting of orders by order received. This is only incremented inside insert(), which copies
-    // current value into Priority
+    // current value into Priority of the order, and when an iceberg is refilled inside match()
     uint64_t                            serial_;
 
+    // Scratch of match(), index in matches of the Match of each iceberg it refilled, by serial given to the refill
+    // since the call started. Kept here so its capacity is reused by later calls.
+    std::vector<size_t>                 refilled_;
+
+    template <Side side> using tag_t = std::integral_constant<Side, side>;
+    constexpr const buys_t& orders(tag_t<Side::Buy>) const { return buys_; }
+    constexpr const sells_t& orders(tag_t<Side::Sell>) const { return sells_; }
+
+    void record(Change c, const Resting& o)
+    {
+        if (deltas_ != nullptr)
+            deltas_->push_back(Delta{c, o.side, o.id, o.price, (c == Change::Remove ? 0 : o.size), o.symbol});
+    }
+
+    static Depth top(const Level* l)
+    {
+        return (l != nullptr ? Depth{l->price, l->count, l->size} : Depth{0, 0, 0});
+    }
+
     template <Side side> orders_t<side>& orders()
     {
         // Mutable version implemented in terms of immutable one (below)
         return const_cast<orders_t<side>&>(
-                (const_cast<const Book&>(*this)).orders<side>()
+                (const_cast<const BasicBook&>(*this)).template orders<side>()
         );
     }
 
 public:
-    Book() : serial_(0)
+    // Parameters, if any, are passed to constructors of both buys_ and sells_ e.g. price band of Ladder
+    template <typename ... Args>
+    explicit BasicBook(const Args& ... args)
+        : buys_(pool_, args...), sells_(pool_, args...), deltas_(nullptr), serial_(0)
     { }
 
-    template <Side side> constexpr const orders_t<side>& orders() const;
+    // Pre-size memory pool and index for this many resting orders, so the global allocator is not called
+    // until this capacity is exceeded
+    void reserve(size_t orders)
+    {
+        pool_.reserve(orders);
+        ids_.reserve(orders);
+    }
 
-    Order& insert(const Order& o);
-    void remove(uint id);
-    template <Side side> void match(Order& active, std::vector<Match>& matches);
-};
+    // Memory pool of orders e.g. to report high-water usage, and index of order ids
+    const Pool& pool() const { return pool_; }
+    const IdIndex<Node*>& ids() const { return ids_; }
 
-template <> inline constexpr bool Book::Sort<Side::Buy>::operator()(Book::Priority lh, Book::Priority rh)
-{
-    // If same price, lower priority (i.e. order placed earlier) wins. Otherwise better (higher bid) price wins
-    return (lh.price == rh.price) ? lh.serial < rh.serial
-                                  : lh.price > rh.price;
-}
+    // Start (or stop, if nullptr) recording changes to resting orders made by insert(), remove() and match()
+    void record(std::vector<Delta>* deltas) { deltas_ = deltas; }
 
-template <> inline constexpr bool Book::Sort<Side::Sell>::operator()(Book::Priority lh, Book::Priority rh)
-{
-    // If same price, lower priority (i.e. order placed earlier) wins. Otherwise better (lower offer) price wins
-    return (lh.price == rh.price) ? lh.serial < rh.serial
-                                  : lh.price < rh.price;
-}
+    template <Side side> constexpr const orders_t<side>& orders() const
+    {
+        return orders(tag_t<side>());
+    }
 
-template <> inline constexpr const Book::orders_t<Side::Buy>& Book::orders<Side::Buy>() const
-{
-    return buys_;
-}
+    // Price levels keep aggregate count and size of their orders, updated by insert(), remove() and match(), so
+    // market data is read from levels without walking individual orders. Best levels are found in constant time.
+    BBO bbo() const
+    {
+        return BBO{top(buys_.best()), top(sells_.best())};
+    }
 
-template <> inline constexpr const Book::orders_t<Side::Sell>& Book::orders<Side::Sell>() const
-{
-    return sells_;
-}
+    // Up to levels best price levels of one side, written to out. Returns the number of levels written.
+    template <Side side> size_t depth(Depth* out, size_t levels) const
+    {
+        size_t n = 0;
+        for (const Level* l = orders<side>().best(); l != nullptr && n < levels; l = l->next)
+            out[n++] = Depth{l->price, l->count, l->size};
+        return n;
+    }
+
+    // Aggregate of orders at this price, with zero count and size if there are none
+    template <Side side> Depth level(uint price) const
+    {
+        const Level* l = orders<side>().find(price);
+        return (l != nullptr ? Depth{price, l->count, l->size} : Depth{price, 0, 0});
+    }
+
+    // L2 snapshot of up to levels price levels of each side, reusing memory of vectors in the snapshot
+    struct Snapshot
+    {
+        std::vector<Depth> bids;
+        std::vector<Depth> asks;
+    };
+
+    void snapshot(size_t levels, Snapshot& s) const
+    {
+        s.bids.resize(levels);
+        s.asks.resize(levels);
+        s.bids.resize(depth<Side::Buy>(s.bids.data(), levels));
+        s.asks.resize(depth<Side::Sell>(s.asks.data(), levels));
+    }
+
+    Resting& insert(const Order& o);
+
+    // Returns false and sets status if there is no order with this id, which is routine e.g. for late cancels
+    bool remove(uint id, Status& status);
+    void remove(uint id)
+    {
+        Status status {};
+        if (not remove(id, status))
+            raise(status);
+    }
+
+    // Appends one Match per resting order filled by the active order, in the order of fills
+    template <Side side> void match(Order& active, std::vector<Match>& matches);
+
+    // Binary snapshot of the whole book, i.e. all resting orders with their time priority and hidden size of
+    // icebergs, and serial_ so that orders inserted after restore() are prioritised as they would be here. All
+    // integers are little-endian.
+    //   header   4 bytes magic "SMBK", uint32 version (1), uint64 serial, then for buy and sell side
+    //            uint64 number of levels and uint64 number of orders
+    //   levels   of buy side from the best to worst price, then of sell side, each uint32 price, uint32 count
+    //            followed by count orders from the first to last in time priority, each uint64 serial,
+    //            uint32 id, size, full, peak, symbol
+    static constexpr uint snapshot_version = 1;
+    void save(std::ostream& out) const;
+
+    // Restores snapshot written by save() into this book, which must be empty. Price levels are appended in bulk
+    // in order of prices, rather than found for each order as in insert(), and changes are not recorded. Throws
+    // smatch::exception if input is not a snapshot of this version, is truncated or inconsistent, and then
+    // leaves the book empty.
+    void restore(std::istream& in);
+};
+
+using MapBook = BasicBook<Map>;
+using LadderBook = BasicBook<Ladder>;
+
+// Book used by Engine, selected at build time
+#ifdef SMATCH_BOOK_LADDER
+using Book = LadderBook;
+#else
+using Book = MapBook;
+#endif
 
 }
@@ -5,22 +5,126 @@
 #include "stream.hpp"
 
 #include <vector>
+#include <memory>
+#include <algorithm>
 
 namespace smatch {
 
 class Engine
 {
+public:
+    using matches_t = std::vector<Match>;
+    using deltas_t = std::vector<Delta>;
+    using levels_t = std::vector<PriceLevel>;
+
+private:
     Book                book_;
+    deltas_t            deltas_;
+
+    // For aggregated output, see levels()
+    size_t              depth_ = 0;
+    levels_t            levels_;
+    Book::Snapshot      last_;      // Top levels written so far, if depth_ is not zero
+    std::vector<Depth>  current_;
+
+    // Changed levels of one side, found by comparing top levels of the book with those written before. Both are
+    // ordered from the best price.
+    template <Side side>
+    void diff(std::vector<Depth>& last, uint symbol)
+    {
+        current_.resize(depth_);
+        current_.resize(book_.depth<side>(current_.data(), depth_));
+        const auto better = [](uint l, uint r) { return side == Side::Buy ? l > r : l < r; };
+        for (size_t i = 0, j = 0; i < current_.size() || j < last.size(); ) {
+            if (j == last.size() || (i < current_.size() && better(current_[i].price, last[j].price))) {
+                const auto& c = current_[i++];
+                levels_.push_back(PriceLevel{side, c.price, c.count, c.size, symbol});
+            }
+            else if (i == current_.size() || better(last[j].price, current_[i].price)) {
+                levels_.push_back(PriceLevel{side, last[j++].price, 0, 0, symbol});
+            }
+            else {
+                const auto& c = current_[i++];
+                const auto& l = last[j++];
+                if (c.count != l.count || c.size != l.size)
+                    levels_.push_back(PriceLevel{side, c.price, c.count, c.size, symbol});
+            }
+        }
+        last.swap(current_);
+    }
 
 public:
-    using matches_t = std::vector<Match>;
+    // Band of prices is only used by Ladder, see Book
+    explicit Engine(const Band& band = Band()) : book_(band)
+    { }
+
     constexpr const auto& book() const { return book_; }
 
+    // Changes to resting orders made by the last order or cancel, only if recording is enabled
+    const deltas_t& deltas() const { return deltas_; }
+
+    // Enable or disable recording of changes in the book, e.g. for incremental output
+    void record(bool enable)
+    {
+        deltas_.clear();
+        book_.record(enable ? &deltas_ : nullptr);
+    }
+
+    // Pre-size the book for this many resting orders
+    void reserve(size_t orders) { book_.reserve(orders); }
+
+    // Number of best levels of each side written by levels(), or 0 for all
+    void depth(size_t levels)
+    {
+        depth_ = levels;
+        last_.bids.clear();
+        last_.asks.clear();
+    }
+
+    // Price levels changed by the last order or cancel, only if recording is enabled. Found from the changes of orders,
+    // and level aggregates kept by the book. If depth is limited, a level which moves out of the best levels is
+    // written with zero count and size, and the one which moves in is written as well.
+    const levels_t& levels()
+    {
+        levels_.clear();
+        if (deltas_.empty())
+            return levels_;
+
+        const uint symbol = deltas_.front().symbol;
+        if (depth_ == 0) {
+            // Deltas of each side are in order of price, since match() fills levels from the best one, and insert()
+            // and remove() change one level. So changes of a level are one run of deltas of its side, and the
+            // aggregate of the level is read once for the run.
+            constexpr size_t none = static_cast<size_t>(-1);
+            size_t last[2] = {none, none}; // Index in levels_ of the last level of each side
+            for (const auto& d : deltas_) {
+                size_t& l = last[d.side == Side::Buy ? 0 : 1];
+                if (l != none && levels_[l].price == d.price)
+                    continue;
+                l = levels_.size();
+                const Depth a = (d.side == Side::Buy ? book_.level<Side::Buy>(d.price) : book_.level<Side::Sell>(d.price));
+                levels_.push_back(PriceLevel{d.side, d.price, a.count, a.size, symbol});
+            }
+            return levels_;
+        }
+
+        // Only sides with any change can have different top levels
+        const auto changed = [&](Side side) {
+            return std::any_of(deltas_.begin(), deltas_.end(), [&](const Delta& d) { return d.side == side; });
+        };
+        if (changed(Side::Buy))
+            diff<Side::Buy>(last_.bids, symbol);
+        if (changed(Side::Sell))
+            diff<Side::Sell>(last_.asks, symbol);
+        return levels_;
+    }
+
     template <Side side>
     bool order(const Order& o, matches_t& matches)
     {
         // Empty collection of matches on input is important precondition for the matching algorithm
         matches.clear();
+        deltas_.clear();
 
         // Copy order received, perform matching first
         Order active = o;
@@ -33,11 +137,113 @@ public:
         return not matches.empty();
     }
 
-    bool cancel(const Cancel& c)
+    // Sets status if there is no such order
+    bool cancel(const Cancel& c, Status& status)
     {
-        book_.remove(c.id);
+        deltas_.clear();
+        book_.remove(c.id, status);
         return false; // No matching performed
     }
+
+    bool cancel(const Cancel& c)
+    {
+        Status status {};
+        cancel(c, status);
+        if (not status.ok())
+            raise(status);
+        return false;
+    }
+};
+
+// Engines of many instruments, each with its own Book. Inputs are routed by symbol, which is a dense id (see Symbols)
+// so engines are stored in a vector indexed by it. Engine for a symbol is created when it is first seen.
+class MultiEngine
+{
+    std::vector<std::unique_ptr<Engine>>    engines_;
+    bool                                    record_;
+    size_t                                  reserve_;
+    size_t                                  depth_;
+    Band                                    band_;
+
+public:
+    MultiEngine() : record_(false), reserve_(0), depth_(0)
+    { }
+
+    Engine& engine(uint symbol)
+    {
+        if (symbol >= engines_.size())
+            engines_.resize(size_t(symbol) + 1);
+        auto& e = engines_[symbol];
+        if (not e) {
+            e.reset(new Engine(band_));
+            e->record(record_);
+            e->depth(depth_);
+            if (reserve_ > 0)
+                e->reserve(reserve_);
+        }
+        return *e;
+    }
+
+    // Engine of this symbol, or nullptr if none was created yet
+    const Engine* find(uint symbol) const
+    {
+        return (symbol < engines_.size() ? engines_[symbol].get() : nullptr);
+    }
+
+    // Give up engine of this symbol (nullptr if none) e.g. to move it to another thread, which must adopt() it
+    std::unique_ptr<Engine> release(uint symbol)
+    {
+        return (symbol < engines_.size() ? std::move(engines_[symbol]) : nullptr);
+    }
+
+    // Symbols of engines created so far, some of which may have been released
+    size_t size() const { return engines_.size(); }
+
+    void adopt(uint symbol, std::unique_ptr<Engine> e)
+    {
+        if (not e)
+            return;
+        if (symbol >= engines_.size())
+            engines_.resize(size_t(symbol) + 1);
+        engines_[symbol] = std::move(e);
+    }
+
+    // Applies to all engines, including created later
+    void record(bool enable)
+    {
+        record_ = enable;
+        for (auto& e : engines_) {
+            if (e)
+                e->record(enable);
+        }
+    }
+
+    size_t depth() const { return depth_; }
+
+    // Applies to all engines, including created later
+    void depth(size_t levels)
+    {
+        depth_ = levels;
+        for (auto& e : engines_) {
+            if (e)
+                e->depth(levels);
+        }
+    }
+
+    const Band& band() const { return band_; }
+
+    // Applies to engines created later only, as a book cannot change its band once it has orders
+    void band(const Band& band) { band_ = band; }
+
+    // Pre-size the book of each symbol for this many resting orders
+    void reserve(size_t orders)
+    {
+        reserve_ = orders;
+        for (auto& e : engines_) {
+            if (e)
+                e->reserve(orders);
+        }
+    }
 };
 
 }
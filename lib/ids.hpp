@@ -0,0 +1,167 @@
+#pragma once
+
+#include "types.hpp"
+
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+namespace smatch {
+
+// Flat hash map from order id to T, using open addressing with Robin Hood probing: on insert, an entry
+// which is further away from its home slot takes the place of one which is closer. This keeps probe
+// sequences short and allows deletion by shifting subsequent entries back, rather than leaving tombstones.
+template <typename T>
+class IdIndex
+{
+    struct Slot {
+        uint key;
+        uint dist; // 1 + distance from home slot, or 0 if slot is empty
+        T value;
+    };
+
+    std::vector<Slot>   slots_;
+    size_t              mask_;
+    unsigned            shift_;
+    size_t              size_;
+
+    static constexpr size_t none = static_cast<size_t>(-1);
+
+    size_t home(uint key) const
+    {
+        // Fibonacci hashing, so that sequential ids are spread across the table
+        return static_cast<size_t>((key * UINT64_C(0x9E3779B97F4A7C15)) >> shift_);
+    }
+
+    // Slot where key is stored, or none. Search stops at the first slot closer to its home than key would be.
+    size_t slot(uint key) const
+    {
+        size_t i = home(key);
+        for (uint dist = 1; slots_[i].dist >= dist; i = (i + 1) & mask_, ++dist) {
+            if (slots_[i].key == key)
+                return i;
+        }
+        return none;
+    }
+
+    // Maximum load factor is 7/8
+    static size_t slots_for(size_t size)
+    {
+        size_t slots = 8;
+        while (slots * 7 < size * 8)
+            slots *= 2;
+        return slots;
+    }
+
+    void rehash(size_t slots)
+    {
+        std::vector<Slot> old(slots, Slot{0, 0, T()});
+        old.swap(slots_);
+        mask_ = slots - 1;
+        shift_ = 64;
+        while (slots > 1) {
+            slots /= 2;
+            --shift_;
+        }
+        size_ = 0;
+        for (const auto& s : old) {
+            if (s.dist != 0)
+                emplace(s.key, s.value);
+        }
+    }
+
+public:
+    explicit IdIndex(size_t capacity = 0) : mask_(0), shift_(0), size_(0)
+    {
+        rehash(slots_for(capacity));
+    }
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    // Number of entries which can be stored without rehashing
+    size_t capacity() const { return slots_.size() * 7 / 8; }
+
+    void reserve(size_t size)
+    {
+        if (size > capacity())
+            rehash(slots_for(size));
+    }
+
+    // Returns pointer to value stored for the key, and false if this key was already present (in which
+    // case its value is left unchanged). The pointer is valid until the next emplace() or erase().
+    std::pair<T*, bool> emplace(uint key, const T& value)
+    {
+        if (size_ + 1 > capacity())
+            rehash(slots_.size() * 2);
+
+        // Find key, or the first slot where the entry for this key should be stored
+        size_t i = home(key);
+        uint dist = 1;
+        for (; slots_[i].dist >= dist; i = (i + 1) & mask_, ++dist) {
+            if (slots_[i].key == key)
+                return std::make_pair(&slots_[i].value, false);
+        }
+
+        // Store the new entry here, and move displaced entries further down until an empty slot is found
+        T* const ret = &slots_[i].value;
+        Slot cur {key, dist, value};
+        for (;; i = (i + 1) & mask_, ++cur.dist) {
+            if (slots_[i].dist == 0) {
+                slots_[i] = cur;
+                break;
+            }
+            if (slots_[i].dist < cur.dist)
+                std::swap(slots_[i], cur);
+        }
+        ++size_;
+        return std::make_pair(ret, true);
+    }
+
+    // Hint that key is about to be inserted or found, e.g. a few keys ahead when building the index in bulk. Homes
+    // of keys are spread across the whole table, so each is likely a cache miss otherwise.
+    void prefetch(uint key) const
+    {
+        __builtin_prefetch(&slots_[home(key)]);
+    }
+
+    T* find(uint key)
+    {
+        const size_t i = slot(key);
+        return (i == none ? nullptr : &slots_[i].value);
+    }
+
+    const T* find(uint key) const
+    {
+        const size_t i = slot(key);
+        return (i == none ? nullptr : &slots_[i].value);
+    }
+
+    // Returns false if key was not found, otherwise value is set to the value stored for the removed key
+    bool extract(uint key, T& value)
+    {
+        size_t i = slot(key);
+        if (i == none)
+            return false;
+
+        value = slots_[i].value;
+        // Shift subsequent entries back by one slot, until an entry in its home slot or empty slot is found
+        for (size_t j = (i + 1) & mask_; slots_[j].dist > 1; i = j, j = (j + 1) & mask_) {
+            slots_[i] = slots_[j];
+            --slots_[i].dist;
+        }
+        slots_[i].dist = 0;
+        --size_;
+        return true;
+    }
+
+    bool erase(uint key)
+    {
+        T value;
+        return extract(key, value);
+    }
+};
+
+}
@@ -17,21 +17,21 @@ class Input
         Cancel c;
     } input;
 
-    typedef bool (Input::*Type)(Engine&, Engine::matches_t&) const;
+    typedef bool (Input::*Type)(Engine&, Engine::matches_t&, Status&) const;
     Type type;
 
     // The return value is to be set by Engine and interpreted by caller of update()
-    template <Side side> bool order(Engine& e, Engine::matches_t& m) const
+    template <Side side> bool order(Engine& e, Engine::matches_t& m, Status&) const
     {
         return e.order<side>(input.o, m);
     }
 
-    bool cancel(Engine& e, Engine::matches_t&) const
+    bool cancel(Engine& e, Engine::matches_t&, Status& status) const
     {
-        return e.cancel(input.c);
+        return e.cancel(input.c, status);
     }
 
-    bool noop(Engine&, Engine::matches_t&) const
+    bool noop(Engine&, Engine::matches_t&, Status&) const
     {
         return false;
     }
@@ -51,12 +51,43 @@ public:
         input.c = c;
     }
 
+    // Errors which are routine, e.g. cancel of unknown order, are returned in status rather than thrown
+    bool handle(Engine& e, Engine::matches_t& m, Status& status) const
+    {
+        return (this->*type)(e, m, status);
+    }
+
     bool handle(Engine& e, Engine::matches_t& m) const
     {
-        return (this->*type)(e, m);
+        Status status {};
+        const bool ret = handle(e, m, status);
+        if (not status.ok())
+            raise(status);
+        return ret;
     }
 
     bool empty() const { return type == &Input::noop; }
+
+    // Stored order or cancel, or nullptr if this input is of the other kind (or empty)
+    const Order* order() const
+    {
+        return (type == &Input::order<Side::Buy> || type == &Input::order<Side::Sell> ? &input.o : nullptr);
+    }
+
+    const Cancel* cancel() const
+    {
+        return (type == static_cast<Type>(&Input::cancel) ? &input.c : nullptr);
+    }
+
+    // Instrument of order or cancel, or default if empty
+    uint symbol() const
+    {
+        if (const Order* o = order())
+            return o->symbol;
+        if (const Cancel* c = cancel())
+            return c->symbol;
+        return 0;
+    }
 };
 
 }
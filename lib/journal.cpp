@@ -0,0 +1,260 @@
+#include "journal.hpp"
+#include "binary.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace smatch {
+
+namespace {
+    constexpr char magic[Journal::header_size] = {'S', 'M', 'J', 'R', 'N', 'L', '0', '1'};
+
+    [[noreturn]] void fail(const std::string& what, const std::string& path)
+    {
+        const std::string message = what + " " + path + ": " + std::strerror(errno);
+        throw exception(message.c_str());
+    }
+
+    uint64_t get64(const char* p)
+    {
+        const auto* u = reinterpret_cast<const unsigned char*>(p);
+        uint64_t v = 0;
+        for (int i = 7; i >= 0; --i)
+            v = (v << 8) | u[i];
+        return v;
+    }
+
+    void put64(char* p, uint64_t v)
+    {
+        for (int i = 0; i < 8; ++i, v >>= 8)
+            p[i] = static_cast<char>(v & 0xFF);
+    }
+
+    uint get32(const char* p)
+    {
+        const auto* u = reinterpret_cast<const unsigned char*>(p);
+        return static_cast<uint>(u[0]) | (static_cast<uint>(u[1]) << 8)
+             | (static_cast<uint>(u[2]) << 16) | (static_cast<uint>(u[3]) << 24);
+    }
+
+    void put32(char* p, uint v)
+    {
+        for (int i = 0; i < 4; ++i, v >>= 8)
+            p[i] = static_cast<char>(v & 0xFF);
+    }
+
+    // Returns true in recovered if there are no records to recover
+    int open(const std::string& path, bool& recovered)
+    {
+        const int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0)
+            fail("Cannot open", path);
+
+        struct stat st;
+        if (::fstat(fd, &st) != 0) {
+            ::close(fd);
+            fail("Cannot stat", path);
+        }
+        recovered = (static_cast<size_t>(st.st_size) <= Journal::header_size);
+        if (st.st_size == 0) {
+            if (::write(fd, magic, sizeof(magic)) != static_cast<ssize_t>(sizeof(magic)) || ::fdatasync(fd) != 0) {
+                ::close(fd);
+                fail("Cannot write", path);
+            }
+            return fd;
+        }
+
+        char header[sizeof(magic)];
+        if (::pread(fd, header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header))
+            || std::memcmp(header, magic, sizeof(magic)) != 0) {
+            ::close(fd);
+            const std::string message = "Not a journal " + path;
+            throw exception(message.c_str());
+        }
+        return fd;
+    }
+
+    // Writes all of data, retrying after partial writes
+    bool write(int fd, const char* data, size_t size)
+    {
+        while (size > 0) {
+            const ssize_t n = ::write(fd, data, size);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return false;
+            data += n;
+            size -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+}
+
+Journal::Journal(const std::string& path, std::chrono::microseconds interval)
+    : fd_(open(path, recovered_)), interval_(interval), sequence_(0), durable_(0), named_(1), syncing_(false)
+    , stop_(false)
+{
+    // Appending starts at the end of the header, unless recover() finds records after it
+    if (::lseek(fd_, header_size, SEEK_SET) < 0) {
+        ::close(fd_);
+        fail("Cannot seek", path);
+    }
+    thread_ = std::thread([this]() { commit(); });
+}
+
+Journal::~Journal()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    wake_.notify_one();
+    thread_.join();
+    ::close(fd_);
+}
+
+uint64_t Journal::replay(const std::function<void(const Input&)>& handle, Symbols* symbols)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (sequence_ != 0)
+        throw exception("Journal already recovered");
+
+    std::vector<char> buffer(record_size * 4096);
+    off_t offset = header_size;
+    uint64_t inputs = 0;
+    Input i;
+    Status status {};
+    for (bool end = false; not end; ) {
+        ssize_t n = 0;
+        do {
+            n = ::pread(fd_, buffer.data(), buffer.size(), offset);
+        } while (n < 0 && errno == EINTR);
+        if (n < 0)
+            throw exception("Cannot read journal");
+        end = (static_cast<size_t>(n) < buffer.size());
+
+        const size_t records = static_cast<size_t>(n) / record_size;
+        for (size_t r = 0; r < records; ++r) {
+            const char* const rec = buffer.data() + r * record_size;
+            const char* const msg = rec + 8;
+            if (get64(rec) != sequence_ + 1)
+                throw exception("Journal records out of sequence");
+            ++sequence_;
+
+            if (msg[0] == 'N') {
+                const uint symbol = get32(msg + 4);
+                const size_t size = ::strnlen(msg + 8, Symbols::max_name);
+                if (symbols != nullptr && symbols->intern(msg + 8, msg + 8 + size) != symbol)
+                    throw exception("Journal does not match symbols");
+                named_ = std::max<size_t>(named_, symbol + 1);
+            }
+            else if (binary::decode(msg, i, status)) {
+                handle(i);
+                ++inputs;
+            }
+            else
+                throw exception("Ill-formed input in journal");
+        }
+        offset += static_cast<off_t>(records * record_size);
+        end = end || records == 0;
+    }
+
+    // Incomplete record at the end is truncated, so that appending continues after the last complete one
+    if (::ftruncate(fd_, offset) != 0 || ::lseek(fd_, offset, SEEK_SET) < 0)
+        throw exception("Cannot truncate journal");
+    durable_ = sequence_;
+    recovered_ = true;
+    return inputs;
+}
+
+void Journal::record(uint64_t sequence, const char* msg)
+{
+    const size_t at = pending_.size();
+    pending_.resize(at + record_size);
+    put64(&pending_[at], sequence);
+    std::memcpy(&pending_[at + 8], msg, binary::message_size);
+}
+
+void Journal::append(const Input& i, const Symbols* symbols)
+{
+    char msg[binary::message_size];
+    binary::encode(i, msg);
+    const uint symbol = i.symbol();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (error_)
+            std::rethrow_exception(error_);
+        if (not recovered_)
+            throw std::logic_error("Journal must be recovered before appending");
+
+        for (; symbols != nullptr && named_ <= symbol && named_ < symbols->size(); ++named_) {
+            char name[binary::message_size] = {'N'};
+            put32(name + 4, static_cast<uint>(named_));
+            const std::string& s = symbols->name(static_cast<uint>(named_));
+            std::memcpy(name + 8, s.data(), std::min(s.size(), size_t(Symbols::max_name)));
+            record(++sequence_, name);
+        }
+        record(++sequence_, msg);
+    }
+}
+
+void Journal::sync()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    const uint64_t target = sequence_;
+    if (durable_ < target && not error_) {
+        syncing_ = true;
+        wake_.notify_one();
+    }
+    committed_.wait(lock, [&]() { return durable_ >= target || error_; });
+    if (error_)
+        std::rethrow_exception(error_);
+}
+
+uint64_t Journal::sequence() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return sequence_;
+}
+
+void Journal::commit()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+        wake_.wait_for(lock, interval_, [this]() { return stop_ || syncing_; });
+        // Nothing to commit, or nothing ever will be after an error. Waiters in sync() are woken either way, and
+        // syncing_ must be cleared, otherwise this would wake up again at once and spin holding mutex_.
+        if (pending_.empty() || error_) {
+            syncing_ = false;
+            committed_.notify_all();
+            if (stop_)
+                return;
+            continue;
+        }
+
+        // Records appended from now on go to the next group
+        writing_.swap(pending_);
+        const uint64_t last = sequence_;
+        syncing_ = false;
+        lock.unlock();
+        const bool ok = write(fd_, writing_.data(), writing_.size()) && ::fdatasync(fd_) == 0;
+        writing_.clear();
+        lock.lock();
+
+        if (ok)
+            durable_ = last;
+        else {
+            const std::string message = std::string("Cannot write journal: ") + std::strerror(errno);
+            error_ = std::make_exception_ptr(std::runtime_error(message));
+        }
+        committed_.notify_all();
+    }
+}
+
+}
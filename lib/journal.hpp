@@ -0,0 +1,154 @@
+#pragma once
+
+#include "types.hpp"
+#include "input.hpp"
+#include "engine.hpp"
+#include "symbols.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+namespace smatch {
+
+// Write-ahead journal of inputs, for recovery of engines after a crash. Inputs are appended as fixed size binary
+// records, and a background thread writes them to the file and makes them durable with fdatasync. All records
+// appended while the previous group was being written are committed together in the next group, so the thread
+// reading inputs never waits for the disk, and the journal lags behind inputs by at most one commit interval (plus
+// time of writing).
+//
+// File starts with 8 bytes of magic "SMJRNL01", followed by records of 32 bytes. All integers are little-endian.
+//   0  uint64  sequence    1 for the first record, incremented for each following record
+//   8  24 bytes            input message as in binary.hpp, or name of instrument, defined before its first input:
+//     8   char    type     'N'
+//     9   3 bytes          reserved, zero
+//     12  uint32  symbol   as interned by Symbols
+//     16  16 bytes name    padded with zeros
+class Journal
+{
+public:
+    static constexpr size_t header_size = 8;
+    static constexpr size_t record_size = 32;
+
+    // Opens journal for appending, creating it if it does not exist. Existing records must be replayed by recover()
+    // before the first append(), which otherwise throws. Throws smatch::exception if the file cannot be opened or is
+    // not a journal.
+    explicit Journal(const std::string& path, std::chrono::microseconds interval = std::chrono::milliseconds(1));
+
+    // Commits all records appended so far
+    ~Journal();
+
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+
+    // Replays all inputs in the journal through engine (Engine or MultiEngine, which should be empty), interning
+    // names of instruments in symbols, unless nullptr. Errors of inputs are ignored, the same as they were when
+    // inputs were first matched. Incomplete record at the end, e.g. torn by a crash while writing, is discarded.
+    // Returns the number of inputs replayed.
+    template <typename E>
+    uint64_t recover(E& e, Symbols* symbols)
+    {
+        Engine::matches_t m;
+        return replay([&](const Input& i) {
+            Status status {};
+            try {
+                i.handle(engine(e, i), m, status);
+            }
+            catch (const smatch::exception&) {
+            }
+        }, symbols);
+    }
+
+    // Appends input, preceded by names of instruments not in the journal yet, if symbols is not nullptr. Can be
+    // called from any thread. Throws std::runtime_error if committing of earlier records has failed; this is not
+    // smatch::exception, so Runner stops rather than reporting it as an error of input and matching on.
+    void append(const Input& i, const Symbols* symbols);
+
+    // Waits until all records appended so far are durable
+    void sync();
+
+    // Of the last record appended
+    uint64_t sequence() const;
+
+private:
+    bool                        recovered_;     // No records left to replay, set by open()
+    const int                   fd_;
+    const std::chrono::microseconds interval_;
+
+    mutable std::mutex          mutex_;
+    std::condition_variable     wake_;          // Of the background thread
+    std::condition_variable     committed_;     // Of threads waiting in sync()
+    std::vector<char>           pending_;       // Records appended since the last commit
+    std::vector<char>           writing_;       // Records being committed, only used by the background thread
+    uint64_t                    sequence_;      // Of the last record appended
+    uint64_t                    durable_;       // Of the last record committed
+    size_t                      named_;         // Symbols with names in the journal, including default one
+    bool                        syncing_;
+    bool                        stop_;
+    std::exception_ptr          error_;
+    std::thread                 thread_;
+
+    static Engine& engine(Engine& e, const Input&) { return e; }
+    static Engine& engine(MultiEngine& e, const Input& i) { return e.engine(i.symbol()); }
+
+    uint64_t replay(const std::function<void(const Input&)>& handle, Symbols* symbols);
+    void record(uint64_t sequence, const char* msg);
+    void commit();
+};
+
+// Channel which appends each well-formed input it reads to journal, unless it is nullptr. Names of instruments are
+// taken from symbols of text channels.
+template <typename Channel>
+struct Journaled : Channel
+{
+    Journal* journal = nullptr;
+
+    using Channel::Channel;
+
+    bool read(Input& i, Status& status)
+    {
+        if (not Channel::read(i, status))
+            return false;
+        if (journal != nullptr && status.ok() && not i.empty())
+            journal->append(i, names(*this, 0));
+        return true;
+    }
+
+    bool read(Input& i)
+    {
+        Status status {};
+        const bool ret = read(i, status);
+        if (not status.ok())
+            raise(status);
+        return ret;
+    }
+
+private:
+    template <typename C>
+    static auto names(const C& ch, int) -> decltype(static_cast<const Symbols*>(ch.symbols))
+    {
+        return ch.symbols;
+    }
+
+    template <typename C>
+    static const Symbols* names(const C&, long)
+    {
+        return nullptr;
+    }
+};
+
+// Channel constructed by the caller, as for the channel wrapped
+template <typename In, typename Channel>
+Journaled<Channel>& channel(In&, Journaled<Channel>& ch)
+{
+    return ch;
+}
+
+}
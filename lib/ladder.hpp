@@ -0,0 +1,135 @@
+#pragma once
+
+#include "types.hpp"
+#include "level.hpp"
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+namespace smatch {
+
+struct bad_price : smatch::exception
+{
+    const uint price;
+
+    bad_price(const char* sz , uint price) : exception(sz) , price(price)
+    { }
+};
+
+// Index of price levels for instruments trading in a bounded band of prices. Levels are stored in a
+// contiguous array indexed by (price - base) / tick. Non-empty levels are also marked in a bitmap, so
+// finding where to link a new level is a scan of a few words.
+template <Side side>
+class LadderLevels
+{
+public:
+    // Default band is wide enough for small prices quoted in ticks of 1, e.g. as in tests
+    static constexpr size_t default_levels = Band().levels;
+
+    explicit LadderLevels(uint base = 0, uint tick = 1, size_t levels = default_levels)
+        : LadderLevels(Band{base, tick, levels})
+    { }
+
+    explicit LadderLevels(const Band& band)
+        : base_(band.base), tick_(band.tick), levels_(band.valid() ? band.levels : 0), bits_((levels_.size() + 63) / 64)
+    {
+        if (levels_.empty())
+            throw smatch::exception("Invalid band of price ladder");
+        for (size_t i = 0; i < levels_.size(); ++i)
+            levels_[i].price = base_ + static_cast<uint>(i) * tick_;
+    }
+
+    // Throws bad_price if price is outside of the band covered by this ladder, or not aligned to tick
+    Level& level(uint price, Level*& prev)
+    {
+        const size_t i = index(price);
+        auto& l = levels_[i];
+        if (l.empty()) {
+            mark(i);
+            const size_t p = better(i);
+            prev = (p == none ? nullptr : &levels_[p]);
+        }
+        return l;
+    }
+
+    // As above, but there is no better level to find
+    Level& back(uint price)
+    {
+        const size_t i = index(price);
+        mark(i);
+        return levels_[i];
+    }
+
+    void drop(Level& l)
+    {
+        unmark(static_cast<size_t>(&l - levels_.data()));
+    }
+
+    const Level* find(uint price) const
+    {
+        if (price < base_ || (price - base_) % tick_ != 0 || (price - base_) / tick_ >= levels_.size())
+            return nullptr;
+        return &levels_[(price - base_) / tick_];
+    }
+
+private:
+    static constexpr size_t none = static_cast<size_t>(-1);
+
+    const uint              base_;
+    const uint              tick_;
+    std::vector<Level>      levels_;
+    std::vector<uint64_t>   bits_; // Set bit for each non-empty level
+
+    size_t index(uint price) const
+    {
+        if (price < base_ || (price - base_) % tick_ != 0 || (price - base_) / tick_ >= levels_.size())
+            throw bad_price("Price outside of book range", price);
+        return (price - base_) / tick_;
+    }
+
+    void mark(size_t i) { bits_[i / 64] |= (uint64_t(1) << (i % 64)); }
+    void unmark(size_t i) { bits_[i / 64] &= ~(uint64_t(1) << (i % 64)); }
+
+    // Lowest non-empty level at index i or above, or none
+    size_t lowest(size_t i) const
+    {
+        size_t w = i / 64;
+        if (w >= bits_.size())
+            return none;
+        uint64_t word = bits_[w] & (~uint64_t(0) << (i % 64));
+        while (word == 0) {
+            if (++w == bits_.size())
+                return none;
+            word = bits_[w];
+        }
+        return w * 64 + __builtin_ctzll(word);
+    }
+
+    // Highest non-empty level at index i or below, or none
+    size_t highest(size_t i) const
+    {
+        size_t w = i / 64;
+        uint64_t word = bits_[w] & (~uint64_t(0) >> (63 - i % 64));
+        while (word == 0) {
+            if (w-- == 0)
+                return none;
+            word = bits_[w];
+        }
+        return w * 64 + 63 - __builtin_clzll(word);
+    }
+
+    // Nearest non-empty level with better price than level at index i, or none
+    size_t better(size_t i) const
+    {
+        if (side == Side::Buy)
+            return lowest(i + 1);
+        else
+            return (i == 0 ? none : highest(i - 1));
+    }
+};
+
+// Orders of one side, with price levels in a bounded band
+template <Side side> using Ladder = Levels<LadderLevels<side>>;
+
+}
@@ -0,0 +1,98 @@
+#include "latency.hpp"
+
+#include <csignal>
+
+#include <unistd.h>
+
+namespace smatch {
+
+namespace latency {
+
+namespace {
+    Histogram histograms[stages];
+
+    // Fixed width text line, formatted without any library calls which might allocate or lock
+    struct Line
+    {
+        char    data[256];
+        size_t  size = 0;
+
+        // Left aligned if width is negative, otherwise right aligned
+        Line& put(const char* s, int width)
+        {
+            size_t n = 0;
+            while (s[n] != '\0')
+                ++n;
+            const size_t pad = static_cast<size_t>(width < 0 ? -width : width);
+            for (size_t i = n; width > 0 && i < pad; ++i)
+                data[size++] = ' ';
+            for (size_t i = 0; i < n; ++i)
+                data[size++] = s[i];
+            for (size_t i = n; width < 0 && i < pad; ++i)
+                data[size++] = ' ';
+            return *this;
+        }
+
+        Line& put(uint64_t v, size_t width)
+        {
+            char tmp[20];
+            size_t n = 0;
+            do {
+                tmp[n++] = static_cast<char>('0' + v % 10);
+                v /= 10;
+            } while (v != 0);
+            for (; n < width; --width)
+                data[size++] = ' ';
+            while (n > 0)
+                data[size++] = tmp[--n];
+            return *this;
+        }
+
+        void write(int fd)
+        {
+            data[size++] = '\n';
+            for (size_t done = 0; done < size; ) {
+                const ssize_t n = ::write(fd, data + done, size - done);
+                if (n <= 0)
+                    return;
+                done += static_cast<size_t>(n);
+            }
+        }
+    };
+
+    void handler(int)
+    {
+        dump(STDERR_FILENO);
+    }
+}
+
+Histogram& histogram(Stage s)
+{
+    return histograms[static_cast<size_t>(s)];
+}
+
+void dump(int fd)
+{
+    if (not enabled)
+        return;
+
+    Line().put("latency ns", -12).put("count", 14).put("p50", 10).put("p90", 10).put("p99", 10)
+          .put("p99.9", 10).put("p99.99", 10).put("max", 12).write(fd);
+    const char* const names[stages] = {"wait", "read", "match", "write"};
+    for (size_t s = 0; s < stages; ++s) {
+        const Histogram& h = histograms[s];
+        Line().put(names[s], -12).put(h.count(), 14)
+              .put(h.percentile(50), 10).put(h.percentile(90), 10).put(h.percentile(99), 10)
+              .put(h.percentile(99.9), 10).put(h.percentile(99.99), 10).put(h.max(), 12).write(fd);
+    }
+}
+
+void dump_on(int signal)
+{
+    if (enabled)
+        std::signal(signal, &handler);
+}
+
+}
+
+}
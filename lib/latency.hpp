@@ -0,0 +1,153 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace smatch {
+
+namespace latency {
+
+// Stages of handling of one input by Runner::run, each timed from the end of the previous one. The channel ends
+// Wait once the whole input is available, otherwise that time is counted in Read.
+enum class Stage
+{
+    Wait,   // Waiting for input, including flush of output when idle
+    Read,   // Parsing of input
+    Match,  // Matching by the engine
+    Write   // Writing of output
+};
+
+constexpr size_t stages = 4;
+
+// High dynamic range histogram of values e.g. nanoseconds. Values are grouped by their highest bit, and each
+// group is split into linear buckets, so the relative error of percentiles is below 1%, from 1 up to the largest
+// uint64_t value. Counts are atomic, so many threads can record and read a histogram without locking.
+class Histogram
+{
+public:
+    static constexpr unsigned bits = 8;
+    static constexpr size_t half = size_t(1) << (bits - 1);
+    static constexpr size_t buckets = (64 - bits + 2) * half;
+
+    void record(uint64_t value)
+    {
+        counts_[bucket(value)].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        uint64_t max = max_.load(std::memory_order_relaxed);
+        while (value > max && not max_.compare_exchange_weak(max, value, std::memory_order_relaxed))
+            ;
+    }
+
+    uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+    uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+
+    // Highest value in the bucket of percentile p e.g. 99.9, or max() if it is lower
+    uint64_t percentile(double p) const
+    {
+        const uint64_t total = count();
+        if (total == 0)
+            return 0;
+        uint64_t rank = static_cast<uint64_t>(p / 100.0 * total + 0.5);
+        rank = (rank == 0 ? 1 : rank > total ? total : rank);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < buckets; ++i) {
+            seen += counts_[i].load(std::memory_order_relaxed);
+            if (seen >= rank) {
+                const uint64_t high = highest(i);
+                return (high < max() ? high : max());
+            }
+        }
+        return max();
+    }
+
+    // Values below 2^bits have their own bucket. Larger ones are shifted right to keep bits significant bits.
+    static size_t bucket(uint64_t value)
+    {
+        if (value < 2 * half)
+            return static_cast<size_t>(value);
+        const unsigned shift = 64 - bits - static_cast<unsigned>(__builtin_clzll(value));
+        return shift * half + static_cast<size_t>(value >> shift);
+    }
+
+    static uint64_t highest(size_t bucket)
+    {
+        if (bucket < 2 * half)
+            return bucket;
+        const unsigned shift = static_cast<unsigned>(bucket / half - 1);
+        const uint64_t top = bucket - shift * half;
+        return ((top + 1) << shift) - 1;
+    }
+
+private:
+    std::atomic<uint64_t>   counts_[buckets] {};
+    std::atomic<uint64_t>   count_ {0};
+    std::atomic<uint64_t>   max_ {0};
+};
+
+// Histograms of nanoseconds spent in each stage, shared by all threads
+Histogram& histogram(Stage s);
+
+// Writes percentiles of all stages to file descriptor, using only async-signal-safe functions. Nothing is written
+// if instrumentation is disabled.
+void dump(int fd);
+
+// Install handler of this signal, which calls dump() for standard error. Does nothing if instrumentation is disabled.
+void dump_on(int signal);
+
+// Instrumentation of Runner::run is enabled at build time with SMATCH_LATENCY. Otherwise these are empty.
+#ifdef SMATCH_LATENCY
+constexpr bool enabled = true;
+
+// End of the last stage in this thread, or zero if this thread is not timing inputs
+inline uint64_t& last()
+{
+    thread_local uint64_t t = 0;
+    return t;
+}
+
+inline uint64_t now()
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// Before reading each input, i.e. before waiting for it
+inline void start()
+{
+    last() = now();
+}
+
+// At the end of input, so that this thread no longer times stages
+inline void stop()
+{
+    last() = 0;
+}
+
+// At the end of each stage. Ignored in threads which did not call start(), e.g. of Pipeline.
+inline void stage(Stage s)
+{
+    uint64_t& t = last();
+    if (t == 0)
+        return;
+    const uint64_t n = now();
+    histogram(s).record(n - t);
+    t = n;
+}
+#else
+constexpr bool enabled = false;
+
+inline void start()
+{ }
+
+inline void stop()
+{ }
+
+inline void stage(Stage)
+{ }
+#endif
+
+}
+
+}
@@ -0,0 +1,272 @@
+#pragma once
+
+#include "types.hpp"
+#include "pool.hpp"
+
+#include <new>
+#include <cstddef>
+#include <cstdint>
+
+namespace smatch {
+
+// Priority of orders within a price level, by order received
+struct Priority {
+    uint64_t serial;
+};
+
+struct Level;
+
+// Resting order, linked into the FIFO queue of its price level. Member names first and second mimic
+// std::pair<const Priority, Resting> i.e. value_type of std::map, which Book used to store orders in.
+// Node takes exactly one cache line, so matching and cancelling touch one line per order (see Pool).
+struct Node {
+    Priority first;
+    Resting second;
+
+    Node* prev;
+    Node* next;
+    Level* level;
+};
+
+static_assert(sizeof(Node) == 64, "Node must fit in a cache line");
+
+// Band of prices an instrument trades in, as levels one tick apart from base. Ladder allocates all of these levels
+// up front, while Map accepts any price and ignores the band.
+struct Band
+{
+    uint base = 0;
+    uint tick = 1;
+    size_t levels = size_t(1) << 16;
+
+    // Not empty, and the highest price of the band fits in uint
+    bool valid() const
+    {
+        return tick > 0 && levels > 0 && (levels - 1) <= (UINT32_MAX - base) / tick;
+    }
+};
+
+// All orders at one price, in an intrusive doubly linked list ordered by time priority. Non-empty levels
+// of one side are also linked together, ordered from the best to the worst price.
+struct Level {
+    uint price;
+    uint count;    // Number of orders
+    uint64_t size; // Aggregate (visible) size of orders
+
+    Node* head;
+    Node* tail;
+
+    Level* prev;
+    Level* next;
+
+    explicit Level(uint price = 0)
+        : price(price), count(0), size(0), head(nullptr), tail(nullptr), prev(nullptr), next(nullptr)
+    { }
+
+    bool empty() const { return head == nullptr; }
+
+    void push_back(Node* n)
+    {
+        n->level = this;
+        n->prev = tail;
+        n->next = nullptr;
+        (tail != nullptr ? tail->next : head) = n;
+        tail = n;
+        ++count;
+        size += n->second.size;
+    }
+
+    void unlink(Node* n)
+    {
+        (n->prev != nullptr ? n->prev->next : head) = n->next;
+        (n->next != nullptr ? n->next->prev : tail) = n->prev;
+        --count;
+        size -= n->second.size;
+    }
+};
+
+// Orders of one side of the book. Index is responsible only for storing price levels and finding the level
+// for a new order; everything else i.e. time priority, iteration and best price is handled here. Index must
+// implement these functions:
+//   Level& level(uint price, Level*& prev) : find or create level for price. If this level is empty, also
+//                                            set prev to the nearest non-empty level with better price
+//                                            (or leave nullptr if there is none), to link the level after
+//   void drop(Level& l)                    : level l is now empty and has been unlinked
+//   const Level* find(uint price) const    : level for price, or nullptr (or empty level) if there are no orders
+//   Level& back(uint price)                : create level for price worse than all non-empty levels, for bulk
+//                                            building of a side in order of prices
+template <typename Index>
+class Levels
+{
+public:
+    template <typename N>
+    class basic_iterator
+    {
+        N* node_;
+
+        template <typename M> friend class basic_iterator;
+
+    public:
+        explicit basic_iterator(N* n = nullptr) : node_(n)
+        { }
+
+        // Allow conversion from iterator to const_iterator, but not the other way around
+        template <typename M>
+        basic_iterator(const basic_iterator<M>& src) : node_(src.node_)
+        { }
+
+        N& operator*() const { return *node_; }
+        N* operator->() const { return node_; }
+
+        basic_iterator& operator++()
+        {
+            if (node_->next != nullptr)
+                node_ = node_->next;
+            else
+                node_ = (node_->level->next != nullptr ? node_->level->next->head : nullptr);
+            return *this;
+        }
+
+        basic_iterator operator++(int)
+        {
+            basic_iterator tmp = *this;
+            ++(*this);
+            return tmp;
+        }
+
+        template <typename M>
+        bool operator==(const basic_iterator<M>& rh) const { return node_ == rh.node_; }
+        template <typename M>
+        bool operator!=(const basic_iterator<M>& rh) const { return node_ != rh.node_; }
+    };
+
+    using value_type = Node;
+    using iterator = basic_iterator<Node>;
+    using const_iterator = basic_iterator<const Node>;
+
+    // Nodes are taken from pool, which may be shared with other Levels. Remaining parameters, if any, are
+    // passed to the constructor of Index
+    template <typename ... Args>
+    explicit Levels(Pool& pool, const Args& ... args) : pool_(pool), index_(args...), best_(nullptr), size_(0)
+    { }
+
+    // Nodes in the pool are not tracked individually, which makes copying non-trivial. Disallow.
+    Levels(const Levels&) = delete;
+    Levels& operator=(const Levels&) = delete;
+
+    ~Levels()
+    {
+        for (Level* l = best_; l != nullptr; l = l->next) {
+            for (Node* n = l->head; n != nullptr; ) {
+                Node* const next = n->next;
+                pool_.deallocate(n, sizeof(Node));
+                n = next;
+            }
+        }
+    }
+
+    bool empty() const { return size_ == 0; }
+    size_t size() const { return size_; }
+
+    iterator begin() { return iterator(first()); }
+    iterator end() { return iterator(); }
+    const_iterator begin() const { return const_iterator(first()); }
+    const_iterator end() const { return const_iterator(); }
+
+    // Best price level, or nullptr if empty
+    const Level* best() const { return best_; }
+
+    // Level at this price, or nullptr if there are no orders at this price
+    const Level* find(uint price) const
+    {
+        const Level* l = index_.find(price);
+        return (l != nullptr && not l->empty() ? l : nullptr);
+    }
+
+    // New order is always placed at the back of its price level i.e. its serial must be the highest so far
+    Node* emplace(uint64_t serial, const Order& o)
+    {
+        const Resting r {o.side, o.id, o.price, o.size, o.full, o.peak, o.symbol};
+        Node* const n = new (pool_.allocate(sizeof(Node))) Node{Priority{serial}, r, nullptr, nullptr, nullptr};
+        Level* prev = nullptr;
+        Level* lp = nullptr;
+        try {
+            lp = &index_.level(o.price, prev);
+        }
+        catch (...) {
+            pool_.deallocate(n, sizeof(Node));
+            throw;
+        }
+
+        Level& l = *lp;
+        if (l.empty())
+            link(l, prev);
+        l.push_back(n);
+        ++size_;
+        return n;
+    }
+
+    // Bulk building of an empty side, e.g. when restoring a snapshot of the book. Levels must be appended from the
+    // best to worst price, each after the level appended before it (prev, or nullptr for the first one), and then
+    // orders to the back of their level in time priority.
+    Level& append(uint price, Level* prev)
+    {
+        Level& l = index_.back(price);
+        link(l, prev);
+        return l;
+    }
+
+    Node* append(Level& l, uint64_t serial, const Resting& r)
+    {
+        Node* const n = new (pool_.allocate(sizeof(Node))) Node{Priority{serial}, r, nullptr, nullptr, nullptr};
+        l.push_back(n);
+        ++size_;
+        return n;
+    }
+
+    // Move order to the back of its price level with new visible size and serial, e.g. to refill an iceberg
+    void refill(Node* n, uint size, uint64_t serial)
+    {
+        Level& l = *n->level;
+        l.unlink(n);
+        n->first.serial = serial;
+        n->second.size = size;
+        l.push_back(n);
+    }
+
+    void erase(Node* n)
+    {
+        Level& l = *n->level;
+        l.unlink(n);
+        if (l.empty()) {
+            (l.prev != nullptr ? l.prev->next : best_) = l.next;
+            if (l.next != nullptr)
+                l.next->prev = l.prev;
+            index_.drop(l);
+        }
+        pool_.deallocate(n, sizeof(Node));
+        --size_;
+    }
+
+private:
+    Pool&   pool_;
+    Index   index_;
+    Level*  best_;
+    size_t  size_;
+
+    // New level l must be placed just after level prev (i.e. on a better price), or at the top if nullptr
+    void link(Level& l, Level* prev)
+    {
+        l.prev = prev;
+        l.next = (prev != nullptr ? prev->next : best_);
+        (prev != nullptr ? prev->next : best_) = &l;
+        if (l.next != nullptr)
+            l.next->prev = &l;
+    }
+
+    Node* first() const
+    {
+        return (best_ == nullptr ? nullptr : best_->head);
+    }
+};
+
+}
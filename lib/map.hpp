@@ -0,0 +1,60 @@
+#pragma once
+
+#include "types.hpp"
+#include "level.hpp"
+#include "pool.hpp"
+
+#include <map>
+#include <functional>
+#include <type_traits>
+
+namespace smatch {
+
+// Index of price levels with no restrictions on price, kept in a map sorted from the best to worst price
+template <Side side>
+class MapLevels
+{
+    using compare_t = typename std::conditional<side == Side::Buy, std::greater<uint>, std::less<uint>>::type;
+    using levels_t = std::map<uint, Level, compare_t, PoolAllocator<std::pair<const uint, Level>>>;
+
+    Pool        pool_;
+    levels_t    levels_;
+
+public:
+    MapLevels() : levels_(compare_t(), typename levels_t::allocator_type(&pool_))
+    { }
+
+    // Any price is accepted, so that Book can be constructed with a band regardless of its levels
+    explicit MapLevels(const Band&) : MapLevels()
+    { }
+
+    Level& level(uint price, Level*& prev)
+    {
+        const auto it = levels_.emplace(price, Level(price)).first;
+        if (it->second.empty() && it != levels_.begin())
+            prev = &std::prev(it)->second;
+        return it->second;
+    }
+
+    // Worst price is at the end of the map, so the hint makes this constant time
+    Level& back(uint price)
+    {
+        return levels_.emplace_hint(levels_.end(), price, Level(price))->second;
+    }
+
+    void drop(Level& l)
+    {
+        levels_.erase(l.price);
+    }
+
+    const Level* find(uint price) const
+    {
+        const auto it = levels_.find(price);
+        return (it != levels_.end() ? &it->second : nullptr);
+    }
+};
+
+// Orders of one side, with price levels in a map
+template <Side side> using Map = Levels<MapLevels<side>>;
+
+}
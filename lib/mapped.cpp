@@ -0,0 +1,114 @@
+#include "mapped.hpp"
+#include "input.hpp"
+#include "latency.hpp"
+
+#include <cstring>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace smatch {
+
+namespace {
+    struct File
+    {
+        int fd;
+
+        ~File()
+        {
+            if (fd >= 0)
+                ::close(fd);
+        }
+    };
+
+    [[noreturn]] void fail(const std::string& what, const std::string& path)
+    {
+        const std::string message = what + " " + path + ": " + std::strerror(errno);
+        throw exception(message.c_str());
+    }
+}
+
+Mapped::Mapped(const std::string& path) : data_(nullptr), size_(0), fd_(-1)
+{
+    // File descriptor is kept once the mapping is made, only to drop pages from the page cache in release()
+    File f {::open(path.c_str(), O_RDONLY)};
+    if (f.fd < 0)
+        fail("Cannot open", path);
+
+    struct stat st;
+    if (::fstat(f.fd, &st) != 0)
+        fail("Cannot stat", path);
+    size_ = static_cast<size_t>(st.st_size);
+    if (size_ == 0)
+        return; // Nothing to map
+
+    void* const p = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, f.fd, 0);
+    if (p == MAP_FAILED)
+        fail("Cannot map", path);
+    data_ = static_cast<const char*>(p);
+    // Hint only, so failure is not an error
+    ::madvise(p, size_, MADV_SEQUENTIAL);
+    fd_ = f.fd;
+    f.fd = -1;
+}
+
+Mapped::~Mapped()
+{
+    if (data_ != nullptr)
+        ::munmap(const_cast<char*>(data_), size_);
+    if (fd_ >= 0)
+        ::close(fd_);
+}
+
+void Mapped::release(size_t offset)
+{
+    const size_t page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+    offset -= offset % page;
+    if (data_ != nullptr && offset > 0) {
+        // Unmapping pages from this process first, as the page cache keeps pages which are still mapped. Both are
+        // hints, so failure is not an error.
+        ::madvise(const_cast<char*>(data_), offset, MADV_DONTNEED);
+        ::posix_fadvise(fd_, 0, static_cast<off_t>(offset), POSIX_FADV_DONTNEED);
+    }
+}
+
+bool MappedStream::read(Input& input, Status& status)
+{
+    // All of input is always available i.e. never idle
+    writer.input(false);
+
+    const size_t size = in.size();
+    if (head_ >= size) {
+        writer.flush();
+        return false; // EOF
+    }
+
+    const char* const line = in.data() + head_;
+    const char* eol = lines_.next(line, in.data() + size);
+    if (eol == nullptr)
+        eol = in.data() + size; // Last line without end of line character
+    head_ = static_cast<size_t>(eol - in.data()) + 1;
+
+    if (head_ - released_ >= release_chunk) {
+        in.release(head_);
+        released_ = head_;
+    }
+
+    latency::stage(latency::Stage::Wait);
+    parse(line, eol, lines_.fields(), input, status, symbols);
+    return true;
+}
+
+bool MappedStream::read(Input& input)
+{
+    Status status {};
+    const bool ret = read(input, status);
+    if (not status.ok())
+        raise(status);
+    return ret;
+}
+
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "types.hpp"
+#include "stream.hpp"
+
+#include <string>
+#include <cstddef>
+
+namespace smatch {
+
+// Read-only memory mapping of a whole file, for input which is already stored e.g. replay of a day of orders
+class Mapped
+{
+    const char* data_;
+    size_t      size_;
+    int         fd_;
+
+public:
+    // Throws smatch::exception if the file cannot be opened or mapped
+    explicit Mapped(const std::string& path);
+    ~Mapped();
+
+    Mapped(const Mapped&) = delete;
+    Mapped& operator=(const Mapped&) = delete;
+
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+
+    // Pages before this offset will not be read again, and are dropped from this process and from the page cache
+    void release(size_t offset);
+};
+
+// Channel reading text input directly from a mapped file, without copying. Same input format as Stream.
+struct MappedStream : TextOutput
+{
+    Mapped& in;
+
+    MappedStream(Mapped& in, std::ostream& out, Flush flush = Flush::Idle, size_t count = 1, Symbols* symbols = nullptr)
+        : TextOutput(out, flush, count, symbols), in(in), head_(0), released_(0)
+    { }
+
+    // As in Stream
+    bool read(Input&, Status& status);
+    bool read(Input&);
+
+private:
+    // Release pages already read in chunks of this size, so replay of large file does not fill memory, neither of
+    // this process nor the page cache (see Mapped::release)
+    static constexpr size_t release_chunk = 64 * 1024 * 1024;
+
+    size_t      head_;     // Start of the next line
+    size_t      released_; // Pages before this offset were released
+    LineScanner lines_;
+};
+
+inline MappedStream channel(Mapped& in, std::ostream& out)
+{
+    return MappedStream(in, out);
+}
+
+// MappedStream constructed by the caller, e.g. with non-default flush policy
+inline MappedStream& channel(Mapped&, MappedStream& st)
+{
+    return st;
+}
+
+}
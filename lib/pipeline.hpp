@@ -0,0 +1,215 @@
+#pragma once
+
+#include "types.hpp"
+#include "input.hpp"
+#include "engine.hpp"
+#include "runner.hpp"
+#include "ring.hpp"
+
+#include <exception>
+#include <thread>
+#include <cstddef>
+
+#include <pthread.h>
+#include <sched.h>
+
+namespace smatch {
+
+// Building blocks of Pipeline and Shards
+namespace pipeline {
+
+// Input or end of input or error of reading, from reader to engine thread
+struct Item
+{
+    Input               input;
+    Status              status {};
+    std::exception_ptr  error;
+    bool                end = false;
+};
+
+// Output or error, from engine to writer thread
+struct Record
+{
+    enum class Kind : char { Match, Order, Delta, Level, Status, Error, Done, End } kind; // Done is end of output of one input
+    union {
+        smatch::Match       match;
+        smatch::Order       order;
+        smatch::Delta       delta;
+        smatch::PriceLevel  level;
+        smatch::Status      status;
+    };
+    std::exception_ptr  error;
+
+    explicit Record(Kind k = Kind::End) : kind(k) { }
+    explicit Record(const smatch::Match& m) : kind(Kind::Match), match(m) { }
+    explicit Record(const smatch::Order& o) : kind(Kind::Order), order(o) { }
+    explicit Record(const smatch::Delta& d) : kind(Kind::Delta), delta(d) { }
+    explicit Record(const smatch::PriceLevel& l) : kind(Kind::Level), level(l) { }
+    explicit Record(const smatch::Status& s) : kind(Kind::Status), status(s) { }
+    explicit Record(std::exception_ptr e) : kind(Kind::Error), error(std::move(e)) { }
+};
+
+// Used by engine thread in place of channel
+struct RingWriter
+{
+    Ring<Record>&   ring;
+    const Wait      wait;
+
+    void push(Record&& r)
+    {
+        // Ring fails only if stopped by the writer thread, and then there is no one to write to
+        ring.push(std::move(r), wait);
+    }
+
+    template <typename T>
+    void write(const T& v) { push(Record(v)); }
+};
+
+// As in Runner::run, smatch::exception is passed to the channel and rethrown only if it wants to
+template <typename Writer>
+inline void report(Writer& wr, const std::exception_ptr& error)
+{
+    try {
+        std::rethrow_exception(error);
+    }
+    catch (const smatch::exception& e) {
+        if (not wr.report(e, true))
+            throw;
+    }
+}
+
+// Returns false at the end of output of one input, or of all inputs
+template <typename Writer>
+inline bool write(Writer& wr, const Record& r)
+{
+    switch (r.kind) {
+        case Record::Kind::Match: wr.write(r.match); break;
+        case Record::Kind::Order: wr.write(r.order); break;
+        case Record::Kind::Delta: wr.write(r.delta); break;
+        case Record::Kind::Level: wr.write(r.level); break;
+        case Record::Kind::Status:
+            if (not Runner::report(wr, r.status))
+                raise(r.status);
+            break;
+        case Record::Kind::Error: report(wr, r.error); break;
+        case Record::Kind::Done:
+        case Record::Kind::End: return false;
+    }
+    return true;
+}
+
+inline void pin(int cpu)
+{
+    if (cpu < 0)
+        return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+}
+
+// Alternative to Runner::run, with reading and parsing of input, matching, and formatting of output each in its own
+// thread. Decoded inputs are passed from the reader to the engine thread, and matches, orders and changes from the
+// engine to the writer thread, through SPSC rings. Exceptions are passed along with inputs and records, so they are
+// reported (or rethrown from run) in the same order as by Runner::run.
+struct Pipeline
+{
+    Wait    wait = Wait::Spin;
+    size_t  capacity = 64 * 1024;   // Of each ring
+
+    // Cores to pin threads to, or -1 to leave them to the scheduler
+    int     reader_cpu = -1;
+    int     engine_cpu = -1;
+    int     writer_cpu = -1;
+
+    // Engine and channels are as passed to Runner::run, but only read() of the reader and write(), report() and
+    // writer of the writer are used, each from its own thread. Flush::Input is the same as Flush::Idle, where idle
+    // means no output is waiting to be written.
+    template <typename E, typename Reader, typename Writer>
+    void run(E& e, Reader& rd, Writer& wr, Runner::Output output = Runner::Output::Book) const
+    {
+        using namespace pipeline;
+        Ring<Item> inputs(capacity);
+        Ring<Record> records(capacity);
+        std::exception_ptr fatal;
+        e.record(output != Runner::Output::Book);
+
+        const auto stop = [&]() {
+            inputs.stop();
+            records.stop();
+        };
+
+        std::thread reader([&]() {
+            pin(reader_cpu);
+            for (;;) {
+                Item it;
+                try {
+                    it.end = not Runner::read(rd, it.input, it.status);
+                }
+                catch (...) {
+                    it.error = std::current_exception();
+                }
+                const bool end = it.end;
+                if (not inputs.push(std::move(it), wait) || end)
+                    return;
+            }
+        });
+
+        std::thread engine([&]() {
+            pin(engine_cpu);
+            RingWriter out {records, wait};
+            for (Item it; inputs.pop(it, wait); ) {
+                if (it.end) {
+                    out.push(Record(Record::Kind::End));
+                    return;
+                }
+                if (it.error) {
+                    out.push(Record(it.error));
+                    continue;
+                }
+                if (not it.status.ok()) {
+                    out.push(Record(it.status));
+                    continue;
+                }
+                try {
+                    const Status status = Runner::handle(it.input, e, out, output);
+                    if (not status.ok())
+                        out.push(Record(status));
+                }
+                catch (...) {
+                    out.push(Record(std::current_exception()));
+                }
+            }
+        });
+
+        std::thread writer([&]() {
+            pin(writer_cpu);
+            try {
+                for (Record r; ; ) {
+                    if (records.empty())
+                        wr.writer.input(true);
+                    if (not records.pop(r, wait))
+                        return;
+                    if (not write(wr, r)) {
+                        wr.writer.flush();
+                        return;
+                    }
+                }
+            }
+            catch (...) {
+                fatal = std::current_exception();
+                stop();
+            }
+        });
+
+        reader.join();
+        engine.join();
+        writer.join();
+        if (fatal)
+            std::rethrow_exception(fatal);
+    }
+};
+
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <new>
+#include <cstddef>
+#include <cstdlib>
+
+namespace smatch {
+
+// Free-list allocator of fixed size blocks, carved from slabs taken from the global allocator. Freed blocks
+// are recycled, so once the pool has grown to the peak number of blocks in use (or was reserved up front
+// to this size) it never calls the global allocator again. Block size is set by the first allocation;
+// requests for a larger size are passed to the global allocator instead. Slabs are aligned to cache lines,
+// so blocks of cache line size (e.g. Node) do not straddle two lines.
+class Pool
+{
+    struct Free {
+        Free* next;
+    };
+
+    size_t              block_;     // Size of block, zero until first allocation
+    size_t              capacity_;  // Blocks in all slabs
+    size_t              reserve_;   // Capacity requested before block size was known
+    size_t              size_;      // Blocks in use
+    size_t              high_;      // High-water mark of size_
+    Free*               free_;
+    std::vector<void*>  slabs_;
+
+    void grow(size_t blocks)
+    {
+        void* p = nullptr;
+        if (posix_memalign(&p, cache_line, blocks * block_) != 0)
+            throw std::bad_alloc();
+        char* const slab = static_cast<char*>(p);
+        slabs_.push_back(slab);
+        // Push blocks in reverse, so they are handed out in address order
+        for (size_t i = blocks; i-- > 0; ) {
+            Free* const f = reinterpret_cast<Free*>(slab + i * block_);
+            f->next = free_;
+            free_ = f;
+        }
+        capacity_ += blocks;
+    }
+
+public:
+    static constexpr size_t cache_line = 64;
+
+    explicit Pool(size_t capacity = 0)
+        : block_(0), capacity_(0), reserve_(capacity), size_(0), high_(0), free_(nullptr)
+    { }
+
+    // Blocks are not tracked individually, so copying is impossible
+    Pool(const Pool&) = delete;
+    Pool& operator=(const Pool&) = delete;
+
+    ~Pool()
+    {
+        for (void* s : slabs_)
+            std::free(s);
+    }
+
+    void* allocate(size_t size)
+    {
+        if (block_ == 0) {
+            constexpr size_t align = alignof(std::max_align_t);
+            block_ = (std::max(size, sizeof(Free)) + align - 1) / align * align;
+            if (reserve_ > 0)
+                grow(reserve_);
+        }
+        else if (size > block_)
+            return ::operator new(size);
+
+        // Grow geometrically, to keep the number of slabs (and calls to global allocator) small
+        if (free_ == nullptr)
+            grow(std::max<size_t>(capacity_, 64));
+
+        Free* const f = free_;
+        free_ = f->next;
+        high_ = std::max(high_, ++size_);
+        return f;
+    }
+
+    void deallocate(void* p, size_t size)
+    {
+        if (size > block_) {
+            ::operator delete(p);
+            return;
+        }
+
+        Free* const f = static_cast<Free*>(p);
+        f->next = free_;
+        free_ = f;
+        --size_;
+    }
+
+    // Make sure that at least this many blocks can be in use without calling global allocator
+    void reserve(size_t blocks)
+    {
+        if (block_ == 0)
+            reserve_ = std::max(reserve_, blocks);
+        else if (blocks > capacity_)
+            grow(blocks - capacity_);
+    }
+
+    size_t block() const { return block_; }
+    size_t size() const { return size_; }
+    size_t capacity() const { return std::max(capacity_, reserve_); }
+    size_t high_water() const { return high_; }
+};
+
+// Adaptor for standard containers. Only single elements (e.g. nodes of std::map or std::unordered_map)
+// are taken from the pool, arrays (e.g. buckets of std::unordered_map) come from the global allocator.
+template <typename T>
+struct PoolAllocator
+{
+    using value_type = T;
+
+    Pool* pool;
+
+    explicit PoolAllocator(Pool* pool) : pool(pool)
+    { }
+
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>& src) : pool(src.pool)
+    { }
+
+    T* allocate(size_t n)
+    {
+        if (n == 1)
+            return static_cast<T*>(pool->allocate(sizeof(T)));
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, size_t n)
+    {
+        if (n == 1)
+            pool->deallocate(p, sizeof(T));
+        else
+            ::operator delete(p);
+    }
+
+    template <typename U>
+    bool operator==(const PoolAllocator<U>& rh) const { return pool == rh.pool; }
+    template <typename U>
+    bool operator!=(const PoolAllocator<U>& rh) const { return pool != rh.pool; }
+};
+
+}
@@ -0,0 +1,208 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <utility>
+#include <new>
+#include <cstddef>
+#include <cstdlib>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+namespace smatch {
+
+// How a thread waits for the ring to become non-empty (consumer) or non-full (producer)
+enum class Wait
+{
+    Spin,   // Busy loop, lowest latency but occupies the core. Yields once in a while, in case cores are shared.
+    Block   // Sleep on condition variable, woken up by the other thread
+};
+
+// Bounded lock-free queue for exactly one producer thread and one consumer thread. Head and tail are on separate
+// cache lines, and each side keeps a cached copy of the other side's index, so the cache line owned by the other
+// thread is only read when the ring appears full (producer) or empty (consumer).
+template <typename T>
+class Ring
+{
+    static constexpr size_t cache_line = 64;
+
+    // Sleeping thread waiting for the other one, only used with Wait::Block
+    struct Signal
+    {
+        std::mutex              mutex;
+        std::condition_variable cv;
+        std::atomic<bool>       sleeping {false};
+
+        template <typename Ready>
+        void wait(Ready ready)
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            sleeping.store(true);
+            // Pairs with the fence in notify(), so either we see the update or the other thread sees sleeping
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            cv.wait(lock, ready);
+            sleeping.store(false, std::memory_order_relaxed);
+        }
+
+        void notify()
+        {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (sleeping.load(std::memory_order_relaxed)) {
+                std::lock_guard<std::mutex> lock(mutex);
+                cv.notify_one();
+            }
+        }
+    };
+
+    static void pause()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        _mm_pause();
+#endif
+    }
+
+    template <typename Ready>
+    static void spin(Ready ready)
+    {
+        for (unsigned i = 1; not ready(); ++i) {
+            if (i % 1024 == 0)
+                std::this_thread::yield();
+            else
+                pause();
+        }
+    }
+
+    std::vector<T>  slots_;
+    const size_t    mask_;
+
+    // Written by consumer
+    alignas(cache_line) std::atomic<size_t> head_;
+    size_t                                  tail_cache_;
+    Signal                                  not_full_;
+
+    // Written by producer
+    alignas(cache_line) std::atomic<size_t> tail_;
+    size_t                                  head_cache_;
+    Signal                                  not_empty_;
+
+    // Set by either side, or by a third thread
+    alignas(cache_line) std::atomic<bool>   stopped_;
+
+    // Producer only. Returns false if the ring is full. Does not wake up consumer, see push().
+    bool try_push(T&& v)
+    {
+        const size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_cache_ == slots_.size()) {
+            head_cache_ = head_.load(std::memory_order_acquire);
+            if (tail - head_cache_ == slots_.size())
+                return false;
+        }
+        slots_[tail & mask_] = std::move(v);
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer only. Returns false if the ring is empty. Does not wake up producer, see pop().
+    bool try_pop(T& v)
+    {
+        const size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_cache_) {
+            tail_cache_ = tail_.load(std::memory_order_acquire);
+            if (head == tail_cache_)
+                return false;
+        }
+        v = std::move(slots_[head & mask_]);
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    static size_t round_up(size_t capacity)
+    {
+        size_t size = 2;
+        while (size < capacity)
+            size *= 2;
+        return size;
+    }
+
+public:
+    // Capacity is rounded up to a power of 2
+    explicit Ring(size_t capacity)
+        : slots_(round_up(capacity)), mask_(slots_.size() - 1)
+        , head_(0), tail_cache_(0), tail_(0), head_cache_(0), stopped_(false)
+    { }
+
+    Ring(const Ring&) = delete;
+    Ring& operator=(const Ring&) = delete;
+
+    // Before C++17, new does not respect alignment of cache lines, e.g. for rings created per shard
+    static void* operator new(size_t size)
+    {
+        void* p = nullptr;
+        if (posix_memalign(&p, cache_line, size) != 0)
+            throw std::bad_alloc();
+        return p;
+    }
+
+    static void operator delete(void* p) { std::free(p); }
+
+    size_t capacity() const { return slots_.size(); }
+
+    // Consumer only, e.g. to do something else before waiting in pop()
+    bool empty() const
+    {
+        return head_.load(std::memory_order_relaxed) == tail_.load(std::memory_order_acquire);
+    }
+
+    // Producer only. Waits while the ring is full, returns false if stopped.
+    bool push(T&& v, Wait wait)
+    {
+        if (not try_push(std::move(v))) {
+            const auto ready = [&]() { return stopped() || try_push(std::move(v)); };
+            if (wait == Wait::Spin)
+                spin(ready);
+            else
+                not_full_.wait(ready);
+            if (stopped())
+                return false;
+        }
+        if (wait == Wait::Block)
+            not_empty_.notify();
+        return true;
+    }
+
+    // Consumer only. Waits while the ring is empty, returns false if stopped.
+    bool pop(T& v, Wait wait)
+    {
+        if (not try_pop(v)) {
+            const auto ready = [&]() { return stopped() || try_pop(v); };
+            if (wait == Wait::Spin)
+                spin(ready);
+            else
+                not_empty_.wait(ready);
+            if (stopped())
+                return false;
+        }
+        if (wait == Wait::Block)
+            not_full_.notify();
+        return true;
+    }
+
+    // Wake up and fail any waiting push() or pop(), e.g. when either side has failed
+    void stop()
+    {
+        stopped_.store(true);
+        for (auto* s : {&not_full_, &not_empty_}) {
+            std::lock_guard<std::mutex> lock(s->mutex);
+            s->cv.notify_all();
+        }
+    }
+
+    bool stopped() const { return stopped_.load(std::memory_order_relaxed); }
+};
+
+}
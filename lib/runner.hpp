@@ -4,50 +4,142 @@
 #include "input.hpp"
 #include "engine.hpp"
 #include "stream.hpp"
+#include "latency.hpp"
 
 namespace smatch {
 
 struct Runner
 {
-    template<typename In, typename Out>
-    static void run(Engine& e, In& in, Out& out)
+    // What is written after each input, apart from matches
+    enum class Output
+    {
+        Book,   // All resting orders
+        Delta,  // Only changes to resting orders made by this input
+        Level   // Only price levels changed by this input, aggregated, see Engine::depth()
+    };
+
+    // Engine is either Engine or MultiEngine
+    template<typename E, typename In, typename Out>
+    static void run(E& e, In& in, Out& out, Output output = Output::Book)
     {
         // Use overloading and ADL to construct communication channel wrapper appropriate for In/Out
         auto&& ch = channel(in, out);
         Input i;
+        e.record(output != Output::Book);
 
         for (;;) {
-            // Handle own exceptions (e.g. bad input or bad order id) per each input
+            // Routine errors (e.g. bad input or bad order id) are returned in status, other exceptions of our own
+            // are handled per each input
+            Status status {};
             try {
-                if (not ch.read(i))
+                latency::start();
+                if (not read(ch, i, status)) {
+                    latency::stop();
                     return;
+                }
+                latency::stage(latency::Stage::Read);
 
-                handle(i, e, ch);
+                if (status.ok()) {
+                    status = handle(i, e, ch, output);
+                    latency::stage(latency::Stage::Write);
+                }
             }
             catch(const smatch::exception& e) {
                 if (not ch.report(e, true))
                     throw;
             }
+
+            if (not status.ok() && not report(ch, status))
+                raise(status);
         }
     }
 
+    // Returns error of order or cancel, if any
     template<typename Writer>
-    static void handle(const Input& i, Engine& e, Writer& wr)
+    static Status handle(const Input& i, Engine& e, Writer& wr, Output output = Output::Book)
     {
+        Status status {};
         if (i.empty())
-            return;
+            return status;
 
         // Function Input.handle() returns true only if any matches found (and stored in m)
         thread_local static Engine::matches_t m;
-        if (i.handle(e, m)) {
+        const bool matched = i.handle(e, m, status);
+        latency::stage(latency::Stage::Match);
+        if (matched) {
             for (const auto &m : m)
                 wr.write(m);
         }
+        if (not status.ok())
+            return status;
+
+        if (output == Output::Delta) {
+            for (const auto &d : e.deltas())
+                wr.write(d);
+            return status;
+        }
+
+        if (output == Output::Level) {
+            for (const auto &l : e.levels())
+                wr.write(l);
+            return status;
+        }
 
         for (const auto &b : e.book().orders<Side::Buy>())
-            wr.write(b.second);
+            wr.write(b.second.order());
         for (const auto &s : e.book().orders<Side::Sell>())
-            wr.write(s.second);
+            wr.write(s.second.order());
+        return status;
+    }
+
+    // Only book of the instrument of this input is written
+    template<typename Writer>
+    static Status handle(const Input& i, MultiEngine& e, Writer& wr, Output output = Output::Book)
+    {
+        if (i.empty())
+            return Status {};
+        return handle(i, e.engine(i.symbol()), wr, output);
+    }
+
+    // Channels may implement read(Input&, Status&) and report(const Status&) to avoid throwing on routine errors,
+    // otherwise these fall back to read(Input&), and to report(const exception&, bool) with exception not thrown
+    template<typename Channel>
+    static bool read(Channel& ch, Input& i, Status& status)
+    {
+        return read(ch, i, status, 0);
+    }
+
+    template<typename Channel>
+    static bool report(Channel& ch, const Status& status)
+    {
+        return report(ch, status, 0);
+    }
+
+private:
+    template<typename Channel>
+    static auto read(Channel& ch, Input& i, Status& status, int) -> decltype(ch.read(i, status))
+    {
+        return ch.read(i, status);
+    }
+
+    template<typename Channel>
+    static bool read(Channel& ch, Input& i, Status&, long)
+    {
+        return ch.read(i);
+    }
+
+    template<typename Channel>
+    static auto report(Channel& ch, const Status& status, int) -> decltype(ch.report(status))
+    {
+        return ch.report(status);
+    }
+
+    template<typename Channel>
+    static bool report(Channel& ch, const Status& status, long)
+    {
+        if (status.order_id())
+            return ch.report(bad_order_id(message(status.error), status.id), true);
+        return ch.report(bad_input(message(status.error)), true);
     }
 };
 
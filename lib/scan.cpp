@@ -0,0 +1,331 @@
+#include "scan.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SMATCH_SCAN_X86
+#endif
+
+namespace smatch {
+
+namespace {
+    size_t scalar(const char* data, size_t size, uint32_t* eols, size_t max)
+    {
+        size_t n = 0;
+        for (const char* p = data; n < max; ++p) {
+            p = static_cast<const char*>(std::memchr(p, '\n', size - (p - data)));
+            if (p == nullptr)
+                break;
+            eols[n++] = static_cast<uint32_t>(p - data);
+        }
+        return n;
+    }
+
+    // Store offsets of bits set in mask of block starting at offset i. Returns false if eols is full.
+    inline bool store(uint64_t mask, size_t i, uint32_t* eols, size_t& n, size_t max)
+    {
+        for (; mask != 0; mask &= mask - 1) {
+            if (n == max)
+                return false;
+            eols[n++] = static_cast<uint32_t>(i + __builtin_ctzll(mask));
+        }
+        return true;
+    }
+
+    // Bytes after the last whole block
+    size_t tail(const char* data, size_t i, size_t size, uint32_t* eols, size_t n, size_t max)
+    {
+        for (; i < size && n < max; ++i) {
+            if (data[i] == '\n')
+                eols[n++] = static_cast<uint32_t>(i);
+        }
+        return n;
+    }
+
+    inline bool space(char c)
+    {
+        return c == ' ' || (c >= '\t' && c <= '\r');
+    }
+
+    size_t scalar_fields(const char* data, size_t size, uint32_t* eols, uint32_t* lasts, size_t max,
+                         uint32_t* bounds, size_t max_bounds)
+    {
+        size_t n = 0;
+        size_t k = 0;
+        bool field = false;
+        bool full = false;
+        for (size_t i = 0; i < size && n < max; ++i) {
+            const char c = data[i];
+            if (field == space(c)) {
+                full = full || k == max_bounds;
+                if (not full)
+                    bounds[k++] = static_cast<uint32_t>(i);
+                field = not field;
+            }
+            if (c == '\n') {
+                eols[n] = static_cast<uint32_t>(i);
+                lasts[n++] = (full ? no_fields : static_cast<uint32_t>(k));
+            }
+        }
+        return n;
+    }
+
+    // Lines and bounds of fields found so far by SIMD kernels
+    struct Found
+    {
+        uint32_t* const eols;
+        uint32_t* const lasts;
+        const size_t    max;
+        uint32_t* const bounds;
+        const size_t    max_bounds;
+        size_t          n;
+        size_t          k;
+        uint64_t        carry; // Whether the last character of the previous block is in a field
+        bool            full;
+
+        Found(uint32_t* eols, uint32_t* lasts, size_t max, uint32_t* bounds, size_t max_bounds)
+            : eols(eols), lasts(lasts), max(max), bounds(bounds), max_bounds(max_bounds), n(0), k(0), carry(0), full(false)
+        { }
+
+        // Block at offset i, with bits set for whitespace and end of line characters. Bounds of fields are where bits
+        // change from the previous ones, and the bounds of a line are those up to its end. Returns false if eols is
+        // full.
+        bool block(uint64_t ws, uint64_t nl, size_t i)
+        {
+            const uint64_t in = ~ws;
+            const uint64_t change = in ^ ((in << 1) | carry);
+            carry = in >> 63;
+
+            const size_t first = k;
+            full = full || k + 64 > max_bounds;
+            if (not full) {
+                for (uint64_t mask = change; mask != 0; mask &= mask - 1)
+                    bounds[k++] = static_cast<uint32_t>(i + __builtin_ctzll(mask));
+            }
+            for (; nl != 0; nl &= nl - 1) {
+                if (n == max)
+                    return false;
+                const int bit = __builtin_ctzll(nl);
+                eols[n] = static_cast<uint32_t>(i + bit);
+                lasts[n++] = (full ? no_fields
+                                   : static_cast<uint32_t>(first + __builtin_popcountll(change & (~uint64_t(0) >> (63 - bit)))));
+            }
+            return true;
+        }
+    };
+
+#ifdef SMATCH_SCAN_X86
+    __attribute__((target("sse2")))
+    size_t sse2(const char* data, size_t size, uint32_t* eols, size_t max)
+    {
+        const __m128i nl = _mm_set1_epi8('\n');
+        size_t n = 0;
+        size_t i = 0;
+        for (; i + 64 <= size; i += 64) {
+            const auto* p = reinterpret_cast<const __m128i*>(data + i);
+            const uint64_t m0 = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(p + 0), nl)));
+            const uint64_t m1 = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(p + 1), nl)));
+            const uint64_t m2 = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(p + 2), nl)));
+            const uint64_t m3 = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(p + 3), nl)));
+            if (not store(m0 | (m1 << 16) | (m2 << 32) | (m3 << 48), i, eols, n, max))
+                return n;
+        }
+        return tail(data, i, size, eols, n, max);
+    }
+
+    __attribute__((target("avx2")))
+    size_t avx2(const char* data, size_t size, uint32_t* eols, size_t max)
+    {
+        const __m256i nl = _mm256_set1_epi8('\n');
+        size_t n = 0;
+        size_t i = 0;
+        for (; i + 64 <= size; i += 64) {
+            const auto* p = reinterpret_cast<const __m256i*>(data + i);
+            const uint64_t m0 = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256(p + 0), nl)));
+            const uint64_t m1 = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256(p + 1), nl)));
+            if (not store(m0 | (m1 << 32), i, eols, n, max))
+                return n;
+        }
+        return tail(data, i, size, eols, n, max);
+    }
+
+    // Bitmasks of whitespace and end of line characters in 16 bytes
+    __attribute__((target("sse2")))
+    inline void sse2_masks(const char* p, uint64_t& ws, uint64_t& nl)
+    {
+        const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        const __m128i control = _mm_set1_epi8(4); // '\t' to '\r' are at most this above '\t'
+        const __m128i c = _mm_max_epu8(_mm_sub_epi8(x, _mm_set1_epi8('\t')), control);
+        const __m128i s = _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(c, control));
+        ws = static_cast<uint32_t>(_mm_movemask_epi8(s));
+        nl = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_set1_epi8('\n'))));
+    }
+
+    __attribute__((target("sse2")))
+    inline bool sse2_block(const char* p, size_t i, Found& found)
+    {
+        uint64_t ws[4], nl[4];
+        for (int j = 0; j < 4; ++j)
+            sse2_masks(p + 16 * j, ws[j], nl[j]);
+        return found.block(ws[0] | (ws[1] << 16) | (ws[2] << 32) | (ws[3] << 48),
+                           nl[0] | (nl[1] << 16) | (nl[2] << 32) | (nl[3] << 48), i);
+    }
+
+    __attribute__((target("avx2")))
+    inline void avx2_masks(const char* p, uint64_t& ws, uint64_t& nl)
+    {
+        const __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        const __m256i control = _mm256_set1_epi8(4);
+        const __m256i c = _mm256_max_epu8(_mm256_sub_epi8(x, _mm256_set1_epi8('\t')), control);
+        const __m256i s = _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(c, control));
+        ws = static_cast<uint32_t>(_mm256_movemask_epi8(s));
+        nl = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('\n'))));
+    }
+
+    __attribute__((target("avx2,popcnt")))
+    inline bool avx2_block(const char* p, size_t i, Found& found)
+    {
+        uint64_t ws[2], nl[2];
+        for (int j = 0; j < 2; ++j)
+            avx2_masks(p + 32 * j, ws[j], nl[j]);
+        return found.block(ws[0] | (ws[1] << 32), nl[0] | (nl[1] << 32), i);
+    }
+
+    // Whole blocks, then the bytes after these padded with whitespace to a block, which adds no lines
+    template <bool (*Block)(const char*, size_t, Found&)>
+    inline size_t fields(const char* data, size_t size, Found& found)
+    {
+        size_t i = 0;
+        for (; i + 64 <= size; i += 64) {
+            if (not Block(data + i, i, found))
+                return found.n;
+        }
+        if (i < size) {
+            char last[64];
+            std::memset(last, ' ', sizeof(last));
+            std::memcpy(last, data + i, size - i);
+            Block(last, i, found);
+        }
+        return found.n;
+    }
+
+    __attribute__((target("sse2")))
+    size_t sse2_fields(const char* data, size_t size, uint32_t* eols, uint32_t* lasts, size_t max,
+                       uint32_t* bounds, size_t max_bounds)
+    {
+        Found found(eols, lasts, max, bounds, max_bounds);
+        return fields<&sse2_block>(data, size, found);
+    }
+
+    __attribute__((target("avx2,popcnt")))
+    size_t avx2_fields(const char* data, size_t size, uint32_t* eols, uint32_t* lasts, size_t max,
+                       uint32_t* bounds, size_t max_bounds)
+    {
+        Found found(eols, lasts, max, bounds, max_bounds);
+        return fields<&avx2_block>(data, size, found);
+    }
+#endif
+
+    using kernel_t = size_t (*)(const char*, size_t, uint32_t*, size_t);
+    using fields_t = size_t (*)(const char*, size_t, uint32_t*, uint32_t*, size_t, uint32_t*, size_t);
+
+    kernel_t kernel(Kernel k)
+    {
+        switch (k) {
+#ifdef SMATCH_SCAN_X86
+            case Kernel::SSE2: return &sse2;
+            case Kernel::AVX2: return &avx2;
+#endif
+            default: return &scalar;
+        }
+    }
+
+    fields_t fields_kernel(Kernel k)
+    {
+        switch (k) {
+#ifdef SMATCH_SCAN_X86
+            case Kernel::SSE2: return &sse2_fields;
+            case Kernel::AVX2: return &avx2_fields;
+#endif
+            default: return &scalar_fields;
+        }
+    }
+}
+
+bool supported(Kernel k)
+{
+    switch (k) {
+#ifdef SMATCH_SCAN_X86
+        case Kernel::SSE2: return __builtin_cpu_supports("sse2");
+        case Kernel::AVX2: return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+#endif
+        case Kernel::Scalar: return true;
+        default: return false;
+    }
+}
+
+Kernel best_kernel()
+{
+    static const Kernel best = supported(Kernel::AVX2) ? Kernel::AVX2
+                             : supported(Kernel::SSE2) ? Kernel::SSE2
+                             : Kernel::Scalar;
+    return best;
+}
+
+size_t find_lines(Kernel k, const char* data, size_t size, uint32_t* eols, size_t max)
+{
+    return kernel(supported(k) ? k : Kernel::Scalar)(data, size, eols, max);
+}
+
+size_t find_lines(const char* data, size_t size, uint32_t* eols, size_t max)
+{
+    static const kernel_t best = kernel(best_kernel());
+    return best(data, size, eols, max);
+}
+
+size_t find_fields(Kernel k, const char* data, size_t size, uint32_t* eols, uint32_t* lasts, size_t max,
+                   uint32_t* bounds, size_t max_bounds)
+{
+    return fields_kernel(supported(k) ? k : Kernel::Scalar)(data, size, eols, lasts, max, bounds, max_bounds);
+}
+
+size_t find_fields(const char* data, size_t size, uint32_t* eols, uint32_t* lasts, size_t max,
+                   uint32_t* bounds, size_t max_bounds)
+{
+    static const fields_t best = fields_kernel(best_kernel());
+    return best(data, size, eols, lasts, max, bounds, max_bounds);
+}
+
+const char* LineScanner::next(const char* from, const char* end)
+{
+    if (next_ < count_)
+        return base_ + eols_[next_++];
+
+    // Offsets are 32 bit, so scan at most 4GiB at once
+    constexpr size_t window = std::numeric_limits<uint32_t>::max();
+    for (base_ = from; base_ < end; base_ += window) {
+        const size_t size = std::min<size_t>(end - base_, window);
+        count_ = find_fields(base_, size, eols_.data(), lasts_.data(), eols_.size(), bounds_.data(), bounds_.size());
+        if (count_ > 0) {
+            limit_ = base_ + size;
+            next_ = 1;
+            return base_ + eols_[0];
+        }
+    }
+    next_ = count_ = 0;
+    return nullptr;
+}
+
+Fields LineScanner::fields() const
+{
+    const size_t i = next_ - 1;
+    if (next_ == 0 || lasts_[i] == no_fields)
+        return Fields {nullptr, nullptr, nullptr, 0};
+    const uint32_t first = (i == 0 ? 0 : lasts_[i - 1]);
+    return Fields {base_, limit_, bounds_.data() + first, (lasts_[i] - first) / 2};
+}
+
+}
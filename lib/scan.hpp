@@ -0,0 +1,80 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace smatch {
+
+// Implementation of find_lines() and find_fields(), selected at runtime by what the CPU supports
+enum class Kernel
+{
+    Scalar, // Portable, one line at a time with memchr, or one character at a time for fields
+    SSE2,   // 4 x 16 bytes per 64 byte block
+    AVX2    // 2 x 32 bytes per 64 byte block
+};
+
+// Fastest kernel supported by this CPU
+Kernel best_kernel();
+bool supported(Kernel k);
+
+// Find end of line characters in data of given size (which must be less than 4GiB), and store up to max of their
+// offsets in eols. Returns the number of offsets stored; if this is max, there might be more to find after the
+// last one stored. SIMD kernels compare whole 64 byte blocks and take offsets from the resulting bitmask, so
+// the cost of finding many short lines is much lower than of calling memchr for each.
+size_t find_lines(const char* data, size_t size, uint32_t* eols, size_t max);
+size_t find_lines(Kernel k, const char* data, size_t size, uint32_t* eols, size_t max);
+
+// As find_lines(), but also find bounds of fields in the lines, i.e. offsets where runs of characters other than
+// whitespace (' ' and '\t' to '\r', as in parse()) start and end. These are stored in bounds, alternating start and
+// (exclusive) end, and those of line i are before index lasts[i], from lasts[i - 1] (or 0 for the first line). If
+// there is no room for more than max_bounds, the remaining lines are still found, but with lasts set to no_fields.
+// SIMD kernels take the bounds from where the whitespace bitmask of each block changes, so field offsets of a whole
+// batch of lines are found without a branch per character.
+constexpr uint32_t no_fields = UINT32_MAX;
+size_t find_fields(const char* data, size_t size, uint32_t* eols, uint32_t* lasts, size_t max,
+                   uint32_t* bounds, size_t max_bounds);
+size_t find_fields(Kernel k, const char* data, size_t size, uint32_t* eols, uint32_t* lasts, size_t max,
+                   uint32_t* bounds, size_t max_bounds);
+
+// Fields of a line, field i is from base + bounds[2 * i] to base + bounds[2 * i + 1]. Text after these can be read up
+// to limit, e.g. to load whole words. Not known if base is null.
+struct Fields
+{
+    const char*     base;
+    const char*     limit;
+    const uint32_t* bounds;
+    size_t          count;
+
+    bool known() const { return base != nullptr; }
+};
+
+// Hands out line ends one by one, and fields of these lines, from batches found by find_fields()
+class LineScanner
+{
+public:
+    static constexpr size_t batch = 256;
+    static constexpr size_t batch_bounds = 16 * batch;
+
+    LineScanner() : base_(nullptr), limit_(nullptr), next_(0), count_(0)
+    { }
+
+    // Next end of line after the one previously returned, or nullptr if there is none before end. When the current
+    // batch is used up, the next one is found in text between from (just after the previous end of line, so that
+    // fields start there) and end. Text must not change (e.g. be moved), unless the previous call has returned nullptr.
+    const char* next(const char* from, const char* end);
+
+    // Fields of the line last returned by next(), not known if it has returned nullptr since
+    Fields fields() const;
+
+private:
+    std::array<uint32_t, batch>         eols_;
+    std::array<uint32_t, batch>         lasts_;
+    std::array<uint32_t, batch_bounds>  bounds_;
+    const char*                         base_;
+    const char*                         limit_;
+    size_t                              next_;
+    size_t                              count_;
+};
+
+}
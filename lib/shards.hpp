@@ -0,0 +1,346 @@
+#pragma once
+
+#include "types.hpp"
+#include "input.hpp"
+#include "engine.hpp"
+#include "runner.hpp"
+#include "ring.hpp"
+#include "pipeline.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+namespace smatch {
+
+// Assignment of symbols to shards, which moves cold symbols off the most loaded shard. Load of a symbol is the time
+// spent matching its inputs since the last rebalance(), plus the estimated time to match inputs still queued for it.
+// Only the reader thread uses Balancer, apart from Load::done and Load::nanos updated by the shard owning the symbol.
+class Balancer
+{
+public:
+    struct Load
+    {
+        std::atomic<uint64_t>   done {0};   // Inputs matched
+        std::atomic<uint64_t>   nanos {0};  // Time spent matching them
+        uint64_t                sent = 0;   // Inputs routed to shard
+        uint64_t                last = 0;   // Value of nanos at last rebalance()
+    };
+
+    struct Move
+    {
+        uint    symbol;
+        size_t  from;
+        size_t  to;
+    };
+
+    // Most loaded shard is rebalanced only if its load is over ratio times the load of least loaded one, and then
+    // no more than max_moves symbols are moved at once
+    static constexpr double ratio = 1.25;
+    static constexpr size_t max_moves = 4;
+
+    explicit Balancer(size_t shards) : shards_(shards)
+    { }
+
+    // Symbols are initially assigned round robin, as they are dense ids
+    size_t owner(uint symbol)
+    {
+        grow(symbol);
+        return owners_[symbol];
+    }
+
+    Load& load(uint symbol)
+    {
+        grow(symbol);
+        return loads_[symbol];
+    }
+
+    // Returns symbols to move, already assigned to new owners
+    std::vector<Move> rebalance()
+    {
+        std::vector<uint64_t> cost(loads_.size());
+        std::vector<uint64_t> shard(shards_);
+        for (uint s = 0; s < loads_.size(); ++s) {
+            auto& l = loads_[s];
+            const uint64_t done = l.done.load(std::memory_order_relaxed);
+            const uint64_t nanos = l.nanos.load(std::memory_order_relaxed);
+            const uint64_t queued = (l.sent > done ? l.sent - done : 0);
+            cost[s] = nanos - l.last + (done > 0 ? queued * (nanos / done) : 0);
+            l.last = nanos;
+            shard[owners_[s]] += cost[s];
+        }
+
+        const size_t hot = std::max_element(shard.begin(), shard.end()) - shard.begin();
+        const size_t cold = std::min_element(shard.begin(), shard.end()) - shard.begin();
+        std::vector<Move> moves;
+        if (hot == cold || shard[hot] <= shard[cold] * ratio)
+            return moves;
+
+        // Coldest first, as long as moving the symbol reduces imbalance, and hot shard keeps at least one symbol
+        std::vector<uint> symbols;
+        for (uint s = 0; s < loads_.size(); ++s) {
+            if (owners_[s] == hot && cost[s] > 0)
+                symbols.push_back(s);
+        }
+        std::stable_sort(symbols.begin(), symbols.end(), [&](uint a, uint b) { return cost[a] < cost[b]; });
+        for (size_t i = 0; i + 1 < symbols.size() && moves.size() < max_moves; ++i) {
+            const uint s = symbols[i];
+            if (shard[cold] + cost[s] >= shard[hot] - cost[s])
+                break;
+            shard[hot] -= cost[s];
+            shard[cold] += cost[s];
+            owners_[s] = cold;
+            moves.push_back(Move{s, hot, cold});
+        }
+        return moves;
+    }
+
+private:
+    const size_t        shards_;
+    std::vector<size_t> owners_;
+    std::deque<Load>    loads_;     // Shards keep pointers to loads, so these must not move
+
+    void grow(uint symbol)
+    {
+        // Symbols are bounded by Symbols, or by binary::decode() for binary input
+        while (symbol >= owners_.size()) {
+            owners_.push_back(owners_.size() % shards_);
+            loads_.emplace_back();
+        }
+    }
+};
+
+// Alternative to Runner::run for many instruments, with symbols partitioned across shards. Each shard is a thread
+// owning the engines of its symbols outright, so there is no locking. The reader thread routes decoded inputs to the
+// shard of their symbol, and also tells the writer thread which shard will produce the output of each input. The
+// writer collects output from the shards in this order, so it is the same as written by Runner::run (for the same
+// MultiEngine), regardless of the number of shards or timing of threads.
+//
+// If rebalancing is enabled, the reader moves symbols between shards (see Balancer). To move a symbol, it sends a
+// handoff to the old owner, queued after all inputs of this symbol sent so far, and to the new owner, queued before
+// any input sent from now on. The old owner releases the engine of the symbol after matching all its queued inputs,
+// and the new owner waits for it before matching anything else, so each engine is owned by one thread at a time and
+// inputs of each symbol are matched in order.
+struct Shards
+{
+    Wait    wait = Wait::Spin;
+    size_t  capacity = 64 * 1024;   // Of each ring
+    size_t  rebalance = 0;          // Inputs between rebalancing of symbols, 0 to keep initial assignment
+
+    // Cores to pin threads to, or -1 to leave them to the scheduler. Shards not listed in shard_cpus are not pinned.
+    int                 reader_cpu = -1;
+    int                 writer_cpu = -1;
+    std::vector<int>    shard_cpus;
+
+    // Initial shard of symbol, and the only one if there is no rebalancing
+    static size_t shard(uint symbol, size_t count) { return symbol % count; }
+
+    // One shard per engine, each engine holding only the symbols of its shard. Channels are as in Pipeline::run.
+    template <typename Reader, typename Writer>
+    void run(std::vector<MultiEngine>& engines, Reader& rd, Writer& wr,
+             Runner::Output output = Runner::Output::Book) const
+    {
+        using namespace pipeline;
+        const size_t count = engines.size();
+        if (count == 0)
+            throw smatch::exception("No shards");
+
+        std::vector<std::unique_ptr<Ring<Task>>> inputs;
+        std::vector<std::unique_ptr<Ring<Record>>> records;
+        for (size_t s = 0; s < count; ++s) {
+            inputs.emplace_back(new Ring<Task>(capacity));
+            records.emplace_back(new Ring<Record>(capacity));
+            engines[s].record(output != Runner::Output::Book);
+        }
+        // Shard of each input, in the order of input, or count at the end of input
+        Ring<size_t> sequence(capacity);
+        // Used by the reader, but shards update loads until they are done
+        Balancer balancer(count);
+        std::exception_ptr fatal;
+
+        const auto stop = [&]() {
+            for (size_t s = 0; s < count; ++s) {
+                inputs[s]->stop();
+                records[s]->stop();
+            }
+            sequence.stop();
+        };
+
+        std::thread reader([&]() {
+            pin(reader_cpu);
+            for (size_t n = 1; ; ++n) {
+                Task t;
+                try {
+                    t.item.end = not Runner::read(rd, t.item.input, t.item.status);
+                }
+                catch (...) {
+                    t.item.error = std::current_exception();
+                }
+
+                if (t.item.end) {
+                    for (size_t s = 0; s < count; ++s) {
+                        Task end;
+                        end.item.end = true;
+                        inputs[s]->push(std::move(end), wait);
+                    }
+                    size_t end = count;
+                    sequence.push(std::move(end), wait);
+                    return;
+                }
+
+                if (rebalance > 0 && n % rebalance == 0) {
+                    for (const auto& m : balancer.rebalance()) {
+                        const auto h = std::make_shared<Handoff>(m.symbol, m.from);
+                        Task from, to;
+                        from.handoff = h;
+                        to.handoff = h;
+                        if (not inputs[m.from]->push(std::move(from), wait) || not inputs[m.to]->push(std::move(to), wait))
+                            return;
+                    }
+                }
+
+                // Nothing to write, nothing to route. Errors of reading are reported by the first shard.
+                const bool error = (t.item.error || not t.item.status.ok());
+                if (not error && t.item.input.empty())
+                    continue;
+                size_t s = 0;
+                if (not error) {
+                    const uint symbol = t.item.input.symbol();
+                    s = balancer.owner(symbol);
+                    if (rebalance > 0) {
+                        t.load = &balancer.load(symbol);
+                        ++t.load->sent;
+                    }
+                }
+                if (not inputs[s]->push(std::move(t), wait) || not sequence.push(std::move(s), wait))
+                    return;
+            }
+        });
+
+        std::vector<std::thread> shards;
+        for (size_t s = 0; s < count; ++s) {
+            shards.emplace_back([&, s]() {
+                pin(s < shard_cpus.size() ? shard_cpus[s] : -1);
+                RingWriter out {*records[s], wait};
+                auto& in = *inputs[s];
+                for (Task t; in.pop(t, wait); ) {
+                    if (t.item.end)
+                        return;
+                    if (t.handoff) {
+                        if (not handoff(*t.handoff, s, engines[s], in))
+                            return;
+                        continue;
+                    }
+
+                    const auto start = (t.load != nullptr ? Clock::now() : Clock::time_point());
+                    if (t.item.error)
+                        out.push(Record(t.item.error));
+                    else if (not t.item.status.ok())
+                        out.push(Record(t.item.status));
+                    else {
+                        try {
+                            const Status status = Runner::handle(t.item.input, engines[s], out, output);
+                            if (not status.ok())
+                                out.push(Record(status));
+                        }
+                        catch (...) {
+                            out.push(Record(std::current_exception()));
+                        }
+                    }
+                    if (t.load != nullptr) {
+                        const auto nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start);
+                        t.load->nanos.fetch_add(nanos.count(), std::memory_order_relaxed);
+                        t.load->done.fetch_add(1, std::memory_order_relaxed);
+                    }
+                    out.push(Record(Record::Kind::Done));
+                }
+            });
+        }
+
+        std::thread writer([&]() {
+            pin(writer_cpu);
+            try {
+                for (size_t s; ; ) {
+                    if (sequence.empty())
+                        wr.writer.input(true);
+                    if (not sequence.pop(s, wait))
+                        return;
+                    if (s == count) {
+                        wr.writer.flush();
+                        return;
+                    }
+
+                    auto& ring = *records[s];
+                    for (Record r; ; ) {
+                        if (ring.empty())
+                            wr.writer.input(true);
+                        if (not ring.pop(r, wait))
+                            return;
+                        if (not write(wr, r))
+                            break;
+                    }
+                }
+            }
+            catch (...) {
+                fatal = std::current_exception();
+                stop();
+            }
+        });
+
+        reader.join();
+        for (auto& t : shards)
+            t.join();
+        writer.join();
+        if (fatal)
+            std::rethrow_exception(fatal);
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    // Engine of symbol moved between shards
+    struct Handoff
+    {
+        const uint              symbol;
+        const size_t            from;
+        std::unique_ptr<Engine> engine;
+        std::atomic<bool>       ready {false};
+
+        Handoff(uint symbol, size_t from) : symbol(symbol), from(from)
+        { }
+    };
+
+    // Input, or handoff of symbol, from reader to shard
+    struct Task
+    {
+        pipeline::Item              item;
+        Balancer::Load*             load = nullptr;
+        std::shared_ptr<Handoff>    handoff;
+    };
+
+    // Returns false if stopped, while waiting for the engine from the other shard
+    static bool handoff(Handoff& h, size_t shard, MultiEngine& e, const Ring<Task>& in)
+    {
+        if (h.from == shard) {
+            h.engine = e.release(h.symbol);
+            h.ready.store(true, std::memory_order_release);
+            return true;
+        }
+        while (not h.ready.load(std::memory_order_acquire)) {
+            if (in.stopped())
+                return false;
+            std::this_thread::yield();
+        }
+        e.adopt(h.symbol, std::move(h.engine));
+        return true;
+    }
+};
+
+}
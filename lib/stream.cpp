@@ -1,88 +1,342 @@
 #include "stream.hpp"
 #include "input.hpp"
 #include "book.hpp"
+#include "latency.hpp"
+
+#include <cctype>
+#include <cstring>
 
 namespace smatch {
 
-bool Stream::read(Input &input) {
-    std::string line;
-    if (not std::getline(in, line))
-        return false; // EOF
+namespace {
+    // Fields of input line, separated by optional whitespace (this is what sscanf did before)
+    struct Tokens
+    {
+        const char* p;
+        const char* const end;
+        Symbols* const symbols;
+        Status& status;
 
-    if (line.empty() || line[0] == '#') {
-        input = Input(); // i.e. empty, will be skipped
-        return true;
-    } else
-    switch (line[0]) {
-        case 'M': {
-            Order o;
-            o.add = false;
-            char dummy, side, sentinel;
-            if (std::sscanf(line.c_str(), "%c %c %u %u%c", &dummy, &side, &o.id, &o.size, &sentinel) != 4
-                || not parse(o.side, side))
-                throw bad_input("Ill-formed market order");
-            o.peak = o.full = o.size;
-            if (o.side == Side::Buy)
-                o.price = std::numeric_limits<decltype(o.price)>::max();
-            else // if (o.side == Side::Sell)
-                o.price = std::numeric_limits<decltype(o.price)>::min();
-            input = Input(o);
-            break;
+        static bool space(char c)
+        {
+            return c == ' ' || (c >= '\t' && c <= '\r');
         }
-        case 'O': {
-            Order o;
-            o.add = false;
-            char dummy, side, sentinel;
-            if (std::sscanf(line.c_str(), "%c %c %u %u %u%c", &dummy, &side, &o.id, &o.price, &o.size, &sentinel) != 5
-                || not parse(o.side, side))
-                throw bad_input("Ill-formed order");
-            o.peak = o.full = o.size;
-            input = Input(o);
-            break;
+
+        void skip()
+        {
+            while (p != end && space(*p))
+                ++p;
         }
-        case 'L': {
-            Order o;
-            o.add = true;
-            char dummy, side, sentinel;
-            if (std::sscanf(line.c_str(), "%c %c %u %u %u%c", &dummy, &side, &o.id, &o.price, &o.size, &sentinel) != 5
-                || not parse(o.side, side))
-                throw bad_input("Ill-formed limit order");
-            o.peak = o.full = o.size;
-            input = Input(o);
-            break;
+
+        bool next(char& c)
+        {
+            skip();
+            if (p == end)
+                return false;
+            c = *p++;
+            return true;
         }
-        case 'I': {
-            Order o;
-            o.add = true;
-            char dummy, side, sentinel;
-            if (std::sscanf(line.c_str(), "%c %c %u %u %u %u%c", &dummy, &side, &o.id, &o.price, &o.full, &o.peak, &sentinel) != 6
-                || not parse(o.side, side)
-                || o.peak > o.full)
-                throw bad_input("Ill-formed iceberg order");
-            o.size = o.peak;
-            input = Input(o);
-            break;
+
+        bool next(uint& v)
+        {
+            skip();
+            if (p == end || *p < '0' || *p > '9')
+                return false;
+
+            uint64_t r = 0;
+            do {
+                r = r * 10 + static_cast<uint>(*p++ - '0');
+                if (r > std::numeric_limits<uint>::max())
+                    return false;
+            } while (p != end && *p >= '0' && *p <= '9');
+            v = static_cast<uint>(r);
+            return true;
+        }
+
+        // Nothing must follow the last field (not even whitespace), except for optional name of instrument. This
+        // must start with a letter, and is only accepted if there are symbols to intern it in. Errors of interning
+        // are set in status, other errors are left to the caller.
+        bool done(uint& symbol)
+        {
+            symbol = 0;
+            if (p == end)
+                return true;
+            if (symbols == nullptr || not space(*p))
+                return false;
+
+            skip();
+            if (p == end || not std::isalpha(static_cast<unsigned char>(*p)))
+                return false;
+            const char* const name = p;
+            while (p != end && not space(*p))
+                ++p;
+            if (p != end)
+                return false;
+            return symbols->intern(name, end, symbol, status);
+        }
+    };
+
+    // Fields of input line as found by LineScanner. Only lines of the common form are read, i.e. with fields separated
+    // by whitespace, side of one character and without name of instrument. Reading of others fails, and they are left
+    // to Tokens.
+    struct FieldTokens
+    {
+        const Fields& fields;
+        const char* const end;
+        size_t i;
+
+        const char* from(size_t field) const { return fields.base + fields.bounds[2 * field]; }
+        const char* to(size_t field) const { return fields.base + fields.bounds[2 * field + 1]; }
+
+        bool next(char& c)
+        {
+            if (i == fields.count || to(i) - from(i) != 1)
+                return false;
+            c = *from(i++);
+            return true;
         }
-        case 'C': {
-            Cancel c;
-            char dummy, sentinel;
-            if (std::sscanf(line.c_str(), "%c %u%c", &dummy, &c.id, &sentinel) != 2)
-                throw bad_input("Ill-formed cancel");
-            input = Input(c);
+
+        // Up to 8 digits are checked and converted at once in a 64 bit word, without a branch per digit. Digits are
+        // loaded into the highest bytes, so the lower ones are leading zeros.
+        bool next(uint& v)
+        {
+            if (i == fields.count)
+                return false;
+            const char* p = from(i);
+            const char* const e = to(i++);
+            if (e - p > 10)
+                return false;
+
+            uint64_t high = 0;
+            for (; e - p > 8; ++p) {
+                const auto d = static_cast<unsigned char>(*p - '0');
+                if (d > 9)
+                    return false;
+                high = high * 10 + d;
+            }
+            const auto n = static_cast<size_t>(e - p);
+            uint64_t w = 0; // Little-endian, the first digit is the lowest byte
+            if (p + 8 <= fields.limit)
+                std::memcpy(&w, p, 8);
+            else
+                std::memcpy(&w, p, n);
+            const auto shift = 8 * (8 - n);
+            w = (w << shift) - (UINT64_C(0x3030303030303030) << shift);
+            if (((w + UINT64_C(0x7676767676767676)) | w) & UINT64_C(0x8080808080808080))
+                return false; // Not a digit
+            w = (w * 10) + (w >> 8);
+            w = ((w & UINT64_C(0x000000FF000000FF)) * (100 + (UINT64_C(1000000) << 32))
+                 + ((w >> 16) & UINT64_C(0x000000FF000000FF)) * (1 + (UINT64_C(10000) << 32))) >> 32;
+
+            const uint64_t r = high * 100000000 + w;
+            if (r > std::numeric_limits<uint>::max())
+                return false;
+            v = static_cast<uint>(r);
+            return true;
+        }
+
+        bool done(uint& symbol)
+        {
+            symbol = 0;
+            return i == fields.count && to(i - 1) == end;
+        }
+    };
+
+    // Input of given type, with the other fields read from tokens. Returns the error of this type if ill-formed, and
+    // then input is not changed.
+    template <typename T>
+    Error read(char type, T& t, Input& input)
+    {
+        switch (type) {
+            case 'M': {
+                Order o;
+                o.add = false;
+                char side;
+                if (not (t.next(side) && t.next(o.id) && t.next(o.size) && t.done(o.symbol))
+                    || not parse(o.side, side))
+                    return Error::IllFormedMarket;
+                o.peak = o.full = o.size;
+                if (o.side == Side::Buy)
+                    o.price = std::numeric_limits<decltype(o.price)>::max();
+                else // if (o.side == Side::Sell)
+                    o.price = std::numeric_limits<decltype(o.price)>::min();
+                input = Input(o);
+                return Error::None;
+            }
+            case 'O': {
+                Order o;
+                o.add = false;
+                char side;
+                if (not (t.next(side) && t.next(o.id) && t.next(o.price) && t.next(o.size) && t.done(o.symbol))
+                    || not parse(o.side, side))
+                    return Error::IllFormedOrder;
+                o.peak = o.full = o.size;
+                input = Input(o);
+                return Error::None;
+            }
+            case 'L': {
+                Order o;
+                o.add = true;
+                char side;
+                if (not (t.next(side) && t.next(o.id) && t.next(o.price) && t.next(o.size) && t.done(o.symbol))
+                    || not parse(o.side, side))
+                    return Error::IllFormedLimit;
+                o.peak = o.full = o.size;
+                input = Input(o);
+                return Error::None;
+            }
+            case 'I': {
+                Order o;
+                o.add = true;
+                char side;
+                if (not (t.next(side) && t.next(o.id) && t.next(o.price) && t.next(o.full) && t.next(o.peak) && t.done(o.symbol))
+                    || not parse(o.side, side)
+                    || o.peak > o.full)
+                    return Error::IllFormedIceberg;
+                o.size = o.peak;
+                input = Input(o);
+                return Error::None;
+            }
+            case 'C': {
+                Cancel c;
+                if (not (t.next(c.id) && t.done(c.symbol)))
+                    return Error::IllFormedCancel;
+                input = Input(c);
+                return Error::None;
+            }
+            default:
+                return Error::UnrecognizedInput;
+        }
+    }
+}
+
+bool parse(const char* begin, const char* end, Input& input, Status& status, Symbols* symbols)
+{
+    if (begin == end || *begin == '#') {
+        input = Input(); // i.e. empty, will be skipped
+        return true;
+    }
+
+    // Error of interning the name of instrument is kept, rather than replaced by one of the input type
+    Tokens t {begin + 1, end, symbols, status};
+    const Error e = read(*begin, t, input);
+    if (e != Error::None) {
+        input = Input();
+        if (status.ok())
+            status = Status{e, 0};
+        return false;
+    }
+    return true;
+}
+
+bool parse(const char* begin, const char* end, const Fields& fields, Input& input, Status& status, Symbols* symbols)
+{
+    if (fields.known() && fields.count > 0
+        && fields.base + fields.bounds[0] == begin && fields.bounds[1] - fields.bounds[0] == 1) {
+        FieldTokens t {fields, end, 1};
+        if (read(*begin, t, input) == Error::None)
+            return true;
+    }
+    return parse(begin, end, input, status, symbols);
+}
+
+void parse(const char* begin, const char* end, Input& input, Symbols* symbols)
+{
+    Status status {};
+    if (not parse(begin, end, input, status, symbols))
+        raise(status);
+}
+
+bool Stream::fill()
+{
+    // Move incomplete line to the front of the buffer, and grow it if this line does not fit
+    if (head_ > 0) {
+        std::memmove(buffer_.data(), buffer_.data() + head_, tail_ - head_);
+        tail_ -= head_;
+        head_ = 0;
+    }
+    if (tail_ == buffer_.size())
+        buffer_.resize(buffer_.size() * 2);
+
+    // Only take what is available, so we do not block waiting for more input than one line. If nothing is
+    // available, block for one character (which also makes the streambuf read whatever is available).
+    auto* const sb = in.rdbuf();
+    std::streamsize avail = sb->in_avail();
+    if (avail <= 0) {
+        const auto c = sb->sbumpc();
+        if (c == std::char_traits<char>::eof())
+            return false;
+        buffer_[tail_++] = std::char_traits<char>::to_char_type(c);
+        avail = sb->in_avail();
+    }
+    if (avail > 0) {
+        const auto n = std::min<std::streamsize>(avail, buffer_.size() - tail_);
+        tail_ += static_cast<size_t>(sb->sgetn(buffer_.data() + tail_, n));
+    }
+    return true;
+}
+
+bool Stream::read(Input& input, Status& status)
+{
+    const char* eol = lines_.next(buffer_.data() + head_, buffer_.data() + tail_);
+
+    // Input boundary, also pass whether reading next input might block
+    writer.input(eol == nullptr && in.rdbuf()->in_avail() <= 0);
+
+    while (eol == nullptr) {
+        if (eof_ || not fill()) {
+            eof_ = true;
+            if (head_ == tail_) {
+                writer.flush();
+                return false; // EOF
+            }
+            eol = buffer_.data() + tail_; // Last line without end of line character
             break;
         }
-        default:
-            throw bad_input("Unrecognized input type");
+        eol = lines_.next(buffer_.data() + head_, buffer_.data() + tail_);
     }
+
+    const char* const line = buffer_.data() + head_;
+    head_ = std::min<size_t>(eol - buffer_.data() + 1, tail_);
+    latency::stage(latency::Stage::Wait);
+    parse(line, eol, lines_.fields(), input, status, symbols);
     return true;
 }
 
-bool Stream::report(const exception& e, bool)
+bool Stream::read(Input& input)
+{
+    Status status {};
+    const bool ret = read(input, status);
+    if (not status.ok())
+        raise(status);
+    return ret;
+}
+
+void report(const exception& e)
 {
     if (const auto* tmp = dynamic_cast<const bad_order_id*>(&e))
         std::cerr << tmp->what() << ' ' << tmp->id << std::endl;
     else
         std::cerr << e.what() << std::endl;
+}
+
+void report(const Status& s)
+{
+    if (s.order_id())
+        std::cerr << message(s.error) << ' ' << s.id << std::endl;
+    else
+        std::cerr << message(s.error) << std::endl;
+}
+
+bool TextOutput::report(const exception& e, bool)
+{
+    smatch::report(e);
+    return true;
+}
+
+bool TextOutput::report(const Status& s)
+{
+    smatch::report(s);
     return true;
 }
 
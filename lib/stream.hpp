@@ -1,42 +1,113 @@
 #pragma once
 
 #include "types.hpp"
+#include "writer.hpp"
+#include "scan.hpp"
+#include "symbols.hpp"
 
 #include <iostream>
 #include <stdexcept>
-#include <cstdio>
+#include <vector>
 
 namespace smatch {
 
 // Need forward declaration here
 class Input;
 
-struct bad_input : smatch::exception
-{
-    using exception::exception;
-};
+// Parse one line of text input, without the end of line character. Returns false and sets status if ill-formed, and
+// then input is empty. Names of instruments are interned in symbols, and only accepted if it is not null.
+bool parse(const char* begin, const char* end, Input& input, Status& status, Symbols* symbols = nullptr);
+
+// As above, with fields of the line found by LineScanner, from which lines of the common form are parsed faster
+bool parse(const char* begin, const char* end, const Fields& fields, Input& input, Status& status,
+           Symbols* symbols = nullptr);
+
+// As the first, but throws bad_input if ill-formed
+void parse(const char* begin, const char* end, Input& input, Symbols* symbols = nullptr);
 
-struct Stream
+// Write error in input or order to std::cerr
+void report(const exception& e);
+void report(const Status& s);
+
+// Text output, shared by channels reading text input from different sources. Name of instrument is appended to
+// records, unless it is the default one.
+struct TextOutput
 {
-    std::istream& in;
     std::ostream& out;
+    Writer writer;
+    Symbols* symbols;
 
-    Stream(std::istream& in, std::ostream& out) : in(in), out(out)
+    TextOutput(std::ostream& out, Flush flush, size_t count, Symbols* symbols = nullptr)
+        : out(out), writer(out, flush, count), symbols(symbols)
     { }
 
-    bool read(Input&);
-
     void write(const Match& m)
     {
-        out << "M " << m.buyId << ' ' << m.sellId << ' ' << m.price << ' ' << m.size << std::endl;
+        writer.begin().put('M')
+              .put(' ').put(m.buyId).put(' ').put(m.sellId).put(' ').put(m.price).put(' ').put(m.size);
+        end(m.symbol);
     }
 
     void write(const Order& o)
     {
-        out << "O " << o.side << ' ' << o.id << ' ' << o.price << ' ' << o.size << std::endl;
+        writer.begin().put('O').put(' ').put(static_cast<char>(o.side))
+              .put(' ').put(o.id).put(' ').put(o.price).put(' ').put(o.size);
+        end(o.symbol);
+    }
+
+    void write(const Delta& d)
+    {
+        writer.begin().put('D').put(' ').put(static_cast<char>(d.change)).put(' ').put(static_cast<char>(d.side))
+              .put(' ').put(d.id).put(' ').put(d.price).put(' ').put(d.size);
+        end(d.symbol);
+    }
+
+    void write(const PriceLevel& l)
+    {
+        writer.begin().put('P').put(' ').put(static_cast<char>(l.side))
+              .put(' ').put(l.price).put(' ').put(l.size).put(' ').put(l.count);
+        end(l.symbol);
+    }
+
+    void end(uint symbol)
+    {
+        if (symbol != 0 && symbols != nullptr) {
+            const auto& name = symbols->name(symbol);
+            writer.put(' ').put(name.data(), name.size());
+        }
+        writer.end();
     }
 
+    // Return false to make Runner throw, see raise()
     bool report(const exception& e, bool);
+    bool report(const Status& s);
+};
+
+struct Stream : TextOutput
+{
+    std::istream& in;
+
+    Stream(std::istream& in, std::ostream& out, Flush flush = Flush::Idle, size_t count = 1, Symbols* symbols = nullptr)
+        : TextOutput(out, flush, count, symbols), in(in), buffer_(default_buffer), head_(0), tail_(0), eof_(false)
+    { }
+
+    // Returns false at the end of input. Ill-formed input is returned in status, and then input is empty.
+    bool read(Input&, Status& status);
+
+    // As above, but throws bad_input
+    bool read(Input&);
+
+private:
+    static constexpr size_t default_buffer = 64 * 1024;
+
+    // Input read from the underlying streambuf, lines not parsed yet are between head_ and tail_
+    std::vector<char>   buffer_;
+    size_t              head_;
+    size_t              tail_;
+    bool                eof_;
+    LineScanner         lines_;
+
+    bool fill();
 };
 
 inline Stream channel(std::istream& in, std::ostream& out)
@@ -44,4 +115,10 @@ inline Stream channel(std::istream& in, std::ostream& out)
     return Stream(in, out);
 }
 
+// Stream constructed by the caller, e.g. with non-default flush policy
+inline Stream& channel(std::istream&, Stream& st)
+{
+    return st;
+}
+
 }
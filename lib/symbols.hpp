@@ -0,0 +1,113 @@
+#pragma once
+
+#include "types.hpp"
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace smatch {
+
+// Names of instruments, interned as dense ids so that engines can be found by index rather than by name. Symbol 0
+// is the default instrument with empty name, used when input does not name one.
+class Symbols
+{
+public:
+    // Longer names are rejected, so that text records always fit in Writer
+    static constexpr size_t max_name = 16;
+
+private:
+    // Name padded with zeros, and its size since a name might end with zeros too. Looking up a name builds this
+    // on the stack, so only names interned for the first time allocate.
+    struct Key
+    {
+        uint64_t    words[2];
+        size_t      size;
+
+        Key(const char* begin, const char* end) : words{0, 0}, size(static_cast<size_t>(end - begin))
+        {
+            std::memcpy(words, begin, size);
+        }
+
+        bool operator==(const Key& k) const
+        {
+            return words[0] == k.words[0] && words[1] == k.words[1] && size == k.size;
+        }
+    };
+
+    static_assert(sizeof(Key::words) == max_name, "Key must hold the longest name");
+
+    struct Hash
+    {
+        size_t operator()(const Key& k) const
+        {
+            // Multiplicative hashing of both words, mixing high bits of the product back into low ones
+            constexpr uint64_t golden = 0x9E3779B97F4A7C15ull;
+            const uint64_t h = ((k.words[0] * golden) ^ k.words[1] ^ k.size) * golden;
+            return static_cast<size_t>(h ^ (h >> 32));
+        }
+    };
+
+    std::vector<std::string>                names_;
+    std::unordered_map<Key, uint, Hash>     ids_;
+
+public:
+    // Also the limit of ids of symbols in binary messages, which are not interned (see binary.hpp)
+    static constexpr size_t default_capacity = size_t(1) << 16;
+
+    // Storage for all names is reserved up front and never moved, so name() can be called by one thread (e.g. writer
+    // in Pipeline) while another one interns new names, as long as the id was passed between them.
+    explicit Symbols(size_t capacity = default_capacity) : names_(1)
+    {
+        names_.reserve(capacity);
+    }
+
+    Symbols(const Symbols&) = delete;
+    Symbols& operator=(const Symbols&) = delete;
+
+    // Id of symbol with this name, which is interned if new. Returns false and sets status if name is too long or
+    // there are too many symbols.
+    bool intern(const char* begin, const char* end, uint& id, Status& status)
+    {
+        if (begin == end || static_cast<size_t>(end - begin) > max_name) {
+            status = Status{Error::InvalidSymbol, 0};
+            return false;
+        }
+
+        const Key key(begin, end);
+        const auto i = ids_.find(key);
+        if (i != ids_.end()) {
+            id = i->second;
+            return true;
+        }
+
+        if (names_.size() == names_.capacity()) {
+            status = Status{Error::TooManySymbols, 0};
+            return false;
+        }
+        id = static_cast<uint>(names_.size());
+        ids_.emplace(key, id);
+        names_.emplace_back(begin, end);
+        return true;
+    }
+
+    // As above, but throws bad_input
+    uint intern(const char* begin, const char* end)
+    {
+        uint id = 0;
+        Status status {};
+        if (not intern(begin, end, id, status))
+            raise(status);
+        return id;
+    }
+
+    const std::string& name(uint id) const { return names_[id]; }
+
+    // Including default symbol
+    size_t size() const { return names_.size(); }
+};
+
+}
@@ -3,6 +3,7 @@
 #include <iostream>
 #include <limits>
 #include <stdexcept>
+#include <cstdint>
 
 namespace smatch {
 
@@ -41,14 +42,31 @@ struct Order
     uint full;
     uint peak;
     bool add;
+    uint symbol; // Instrument, see Symbols
+};
 
-    // Reserved for matching engine
-    size_t match;
+// Order resting in the book. Unlike Order it is always added, which leaves room for the links of the book in one
+// cache line (see Node in level.hpp).
+struct Resting
+{
+    Side side;
+    uint id;
+    uint price;
+    uint size;
+    uint full;
+    uint peak;
+    uint symbol;
+
+    Order order() const
+    {
+        return Order{side, id, price, size, full, peak, true, symbol};
+    }
 };
 
 struct Cancel
 {
     uint id;
+    uint symbol;
 };
 
 struct Match
@@ -57,6 +75,58 @@ struct Match
     uint sellId;
     uint price;
     uint size;
+    uint symbol;
+};
+
+// Change of a resting order in the book, for incremental output of the book
+enum class Change : char
+{
+    Add = 'A',      // Order added to the book
+    Reduce = 'R',   // Partially matched, size is the remaining visible size
+    Remove = 'X',   // Cancelled or fully matched, size is zero
+    Refill = 'F'    // Visible slice of an iceberg refilled, and order moved to the back of its price level
+};
+
+inline std::ostream& operator<< (std::ostream& o, Change c)
+{
+    return (o << static_cast<char>(c));
+}
+
+struct Delta
+{
+    Change change;
+    Side side;
+    uint id;
+    uint price;
+    uint size;
+    uint symbol;
+};
+
+// Aggregate of resting orders at one price, for L2 market data. Size is the visible size, i.e. excluding hidden
+// liquidity of icebergs.
+struct Depth
+{
+    uint price;
+    uint count;
+    uint64_t size;
+};
+
+// Best bid and offer, with zero count and size if that side of the book is empty
+struct BBO
+{
+    Depth bid;
+    Depth ask;
+};
+
+// Price level changed by an input, for aggregated (L2) output. Count and size are zero if the level was removed, or
+// moved out of the number of levels written.
+struct PriceLevel
+{
+    Side side;
+    uint price;
+    uint count;
+    uint64_t size;
+    uint symbol;
 };
 
 struct exception : std::runtime_error
@@ -65,4 +135,71 @@ struct exception : std::runtime_error
     { }
 };
 
+struct bad_input : smatch::exception
+{
+    using exception::exception;
+};
+
+struct bad_order_id : smatch::exception
+{
+    const uint id;
+
+    bad_order_id(const char* sz , uint id) : exception(sz) , id(id)
+    { }
+};
+
+// Errors in input or orders, which are routine (e.g. late cancel of an order already filled) so they are returned
+// in Status and reported without throwing. Each has the same message as the exception thrown for it, see raise().
+enum class Error : char
+{
+    None,
+    IllFormedMarket,
+    IllFormedOrder,
+    IllFormedLimit,
+    IllFormedIceberg,
+    IllFormedCancel,
+    UnrecognizedInput,
+    TruncatedMessage,
+    InvalidSymbol,
+    TooManySymbols,
+    InvalidOrderId,     // Errors of order id, also set Status.id
+    DuplicateOrderId
+};
+
+inline const char* message(Error e)
+{
+    switch (e) {
+        case Error::None: return "No error";
+        case Error::IllFormedMarket: return "Ill-formed market order";
+        case Error::IllFormedOrder: return "Ill-formed order";
+        case Error::IllFormedLimit: return "Ill-formed limit order";
+        case Error::IllFormedIceberg: return "Ill-formed iceberg order";
+        case Error::IllFormedCancel: return "Ill-formed cancel";
+        case Error::UnrecognizedInput: return "Unrecognized input type";
+        case Error::TruncatedMessage: return "Truncated message";
+        case Error::InvalidSymbol: return "Invalid symbol";
+        case Error::TooManySymbols: return "Too many symbols";
+        case Error::InvalidOrderId: return "Invalid order id";
+        case Error::DuplicateOrderId: return "Duplicate order id";
+    }
+    return "Unknown error";
+}
+
+struct Status
+{
+    Error error;
+    uint id; // Order id, only for errors of order id
+
+    bool ok() const { return error == Error::None; }
+    bool order_id() const { return error == Error::InvalidOrderId || error == Error::DuplicateOrderId; }
+};
+
+// Throwing wrapper of functions returning Status, with bad_order_id for errors of order id and bad_input otherwise
+[[noreturn]] inline void raise(const Status& s)
+{
+    if (s.order_id())
+        throw bad_order_id(message(s.error), s.id);
+    throw bad_input(message(s.error));
+}
+
 }
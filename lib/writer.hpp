@@ -0,0 +1,141 @@
+#pragma once
+
+#include "types.hpp"
+
+#include <iostream>
+#include <vector>
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+
+namespace smatch {
+
+// When buffered output is passed to the underlying ostream and flushed, apart from when the buffer is full
+enum class Flush
+{
+    Event,  // After each record written
+    Count,  // After every N records written
+    Input,  // Before reading each input
+    Idle    // Before reading input, if none is available without blocking
+};
+
+// Formats records of text output into a large reusable buffer, so there is no ostream formatting or flush
+// per record. Buffer is written to ostream (and flushed) according to the Flush policy, when the buffer is
+// full, and on destruction.
+class Writer
+{
+    // Longest possible text records are "M" followed by 4 numbers, each up to 10 digits, or "P" with up to 20 digits
+    // of size, and name of instrument
+    static constexpr size_t max_record = 80;
+
+    std::ostream&       out_;
+    Flush               flush_;
+    size_t              count_;  // Flush after this many records, for Flush::Count
+    size_t              events_; // Records since last flush
+    std::vector<char>   buffer_;
+    size_t              size_;
+
+public:
+    static constexpr size_t default_capacity = 64 * 1024;
+
+    explicit Writer(std::ostream& out, Flush flush = Flush::Idle, size_t count = 1,
+                    size_t capacity = default_capacity)
+        : out_(out), flush_(flush), count_(count ? count : 1), events_(0)
+        , buffer_(capacity < max_record ? max_record : capacity), size_(0)
+    { }
+
+    // Copy shares the ostream and policy, but not the contents of the buffer
+    Writer(const Writer& src)
+        : out_(src.out_), flush_(src.flush_), count_(src.count_), events_(0), buffer_(src.buffer_.size()), size_(0)
+    { }
+
+    Writer& operator=(const Writer&) = delete;
+
+    ~Writer()
+    {
+        flush();
+    }
+
+    void flush()
+    {
+        if (size_ > 0)
+            out_.write(buffer_.data(), size_);
+        out_.flush();
+        size_ = 0;
+        events_ = 0;
+    }
+
+    // To be called by the reader before reading each input, idle if no input is available without blocking
+    void input(bool idle)
+    {
+        if (flush_ == Flush::Input || (flush_ == Flush::Idle && idle))
+            flush();
+    }
+
+    // Start of record, must be followed by end() or done()
+    Writer& begin()
+    {
+        if (size_ + max_record > buffer_.size())
+            flush();
+        return *this;
+    }
+
+    Writer& put(char c)
+    {
+        buffer_[size_++] = c;
+        return *this;
+    }
+
+    Writer& put(uint v)
+    {
+        // Digits are written from the end of temporary buffer
+        char tmp[10];
+        char* p = tmp + sizeof(tmp);
+        do {
+            *--p = static_cast<char>('0' + v % 10);
+            v /= 10;
+        } while (v != 0);
+        const size_t n = tmp + sizeof(tmp) - p;
+        std::memcpy(&buffer_[size_], p, n);
+        size_ += n;
+        return *this;
+    }
+
+    Writer& put(uint64_t v)
+    {
+        char tmp[20];
+        char* p = tmp + sizeof(tmp);
+        do {
+            *--p = static_cast<char>('0' + v % 10);
+            v /= 10;
+        } while (v != 0);
+        const size_t n = tmp + sizeof(tmp) - p;
+        std::memcpy(&buffer_[size_], p, n);
+        size_ += n;
+        return *this;
+    }
+
+    // Raw bytes e.g. of binary record, must fit within max_record
+    Writer& put(const char* data, size_t size)
+    {
+        std::memcpy(&buffer_[size_], data, size);
+        size_ += size;
+        return *this;
+    }
+
+    // End of text record
+    void end()
+    {
+        buffer_[size_++] = '\n';
+        done();
+    }
+
+    // End of record, without end of line
+    void done()
+    {
+        if (flush_ == Flush::Event || (flush_ == Flush::Count && ++events_ >= count_))
+            flush();
+    }
+};
+
+}
@@ -0,0 +1,232 @@
+#include "catch.hpp"
+
+#include "runner.hpp"
+#include "binary.hpp"
+
+#include <sstream>
+#include <string>
+
+namespace {
+    using namespace smatch;
+
+    // Text input converted to binary messages, like convert tool does
+    std::string convert(const std::string& text)
+    {
+        std::istringstream in(text);
+        std::ostringstream dummy;
+        Stream st(in, dummy);
+        std::string ret;
+        Input i;
+        char msg[binary::message_size];
+        while (st.read(i)) {
+            if (i.empty())
+                continue;
+            binary::encode(i, msg);
+            ret.append(msg, sizeof(msg));
+        }
+        return ret;
+    }
+
+    uint get32(const std::string& s, size_t i)
+    {
+        return static_cast<unsigned char>(s[i]) | (static_cast<unsigned char>(s[i + 1]) << 8)
+             | (static_cast<unsigned char>(s[i + 2]) << 16) | (static_cast<uint>(static_cast<unsigned char>(s[i + 3])) << 24);
+    }
+
+    void put32(char* p, uint v)
+    {
+        for (int i = 0; i < 4; ++i, v >>= 8)
+            p[i] = static_cast<char>(v & 0xFF);
+    }
+
+    // Binary output records converted to text, as Stream writes them
+    std::string text(const std::string& bin)
+    {
+        REQUIRE(bin.size() % binary::record_size == 0);
+        std::ostringstream out;
+        for (size_t i = 0; i < bin.size(); i += binary::record_size) {
+            REQUIRE(bin[i + 3] == 0);
+            REQUIRE(get32(bin, i + 4) == 0); // Default symbol
+            switch (bin[i]) {
+                case 'M':
+                    out << "M " << get32(bin, i + 8) << ' ' << get32(bin, i + 12) << ' ' << get32(bin, i + 16)
+                        << ' ' << get32(bin, i + 20) << '\n';
+                    break;
+                case 'O':
+                    out << "O " << bin[i + 2] << ' ' << get32(bin, i + 8) << ' ' << get32(bin, i + 12)
+                        << ' ' << get32(bin, i + 16) << '\n';
+                    break;
+                case 'D':
+                    out << "D " << bin[i + 1] << ' ' << bin[i + 2] << ' ' << get32(bin, i + 8) << ' '
+                        << get32(bin, i + 12) << ' ' << get32(bin, i + 16) << '\n';
+                    break;
+                case 'P':
+                    out << "P " << bin[i + 2] << ' ' << get32(bin, i + 8) << ' '
+                        << (get32(bin, i + 16) | (uint64_t(get32(bin, i + 20)) << 32)) << ' ' << get32(bin, i + 12) << '\n';
+                    break;
+                default:
+                    FAIL("Unexpected record type");
+            }
+        }
+        return out.str();
+    }
+}
+
+TEST_CASE("binary messages", "[binary]") {
+    using namespace smatch;
+    const std::string input =
+        "L S 1 1020 100\n"
+        "I S 2 1010 300 100\n"
+        "O B 3 1020 150\n"
+        "M B 4 10\n"
+        "M S 5 10\n"
+        "C 1\n";
+    const std::string bin = convert(input);
+    REQUIRE(bin.size() == 6 * binary::message_size);
+
+    // Message layout
+    REQUIRE(bin.substr(0, 4) == std::string("LS\0\0", 4));
+    REQUIRE(get32(bin, 4) == 0);
+    REQUIRE(get32(bin, 8) == 1);
+    REQUIRE(get32(bin, 12) == 1020);
+    REQUIRE(get32(bin, 16) == 100);
+    REQUIRE(get32(bin, 20) == 0);
+    REQUIRE(bin.substr(24, 4) == std::string("IS\0\0", 4));
+    REQUIRE(get32(bin, 40) == 300);
+    REQUIRE(get32(bin, 44) == 100);
+    REQUIRE(bin.substr(72, 4) == std::string("MB\0\0", 4));
+    REQUIRE(bin[120] == 'C');
+    REQUIRE(get32(bin, 128) == 1);
+
+    // Decoding gives the same inputs as parsing text
+    std::istringstream in(input);
+    std::ostringstream dummy;
+    Stream st(in, dummy);
+    Input t, b;
+    for (size_t i = 0; i < bin.size(); i += binary::message_size) {
+        REQUIRE(st.read(t));
+        binary::decode(bin.data() + i, b);
+        if (t.cancel() != nullptr) {
+            REQUIRE(b.cancel() != nullptr);
+            REQUIRE(b.cancel()->id == t.cancel()->id);
+            continue;
+        }
+        const Order& x = *t.order();
+        const Order& y = *b.order();
+        REQUIRE(x.side == y.side);
+        REQUIRE(x.id == y.id);
+        REQUIRE(x.price == y.price);
+        REQUIRE(x.size == y.size);
+        REQUIRE(x.full == y.full);
+        REQUIRE(x.peak == y.peak);
+        REQUIRE(x.add == y.add);
+    }
+}
+
+TEST_CASE("binary channel output is same as text", "[binary]") {
+    using namespace smatch;
+    const std::string input =
+        "L S 1 1020 100\n"
+        "I S 2 1010 300 100\n"
+        "L B 3 1000 50\n"
+        "O B 4 1020 150\n"
+        "C 9\n" // invalid order id
+        "M B 5 10\n"
+        "C 3\n";
+    const std::string bin = convert(input);
+
+    for (const auto output : {Runner::Output::Book, Runner::Output::Delta, Runner::Output::Level}) {
+        std::istringstream tin(input);
+        std::ostringstream tout;
+        Engine e1;
+        Runner::run(e1, tin, tout, output);
+
+        std::istringstream bin_in(bin);
+        std::ostringstream bout;
+        {
+            BinaryStream st(bin_in, bout);
+            Engine e2;
+            Runner::run(e2, bin_in, st, output);
+        }
+        REQUIRE(bout.str().size() % binary::record_size == 0);
+        REQUIRE(text(bout.str()) == tout.str());
+    }
+}
+
+TEST_CASE("ill-formed binary messages", "[binary][parsing]") {
+    using namespace smatch;
+    const std::string valid = convert("I B 1 100 20 10\n");
+    Input i;
+    binary::decode(valid.data(), i);
+    REQUIRE(i.order() != nullptr);
+
+    auto bad = valid;
+    bad[0] = 'X';
+    REQUIRE_THROWS_AS(binary::decode(bad.data(), i), bad_input&);
+    bad = valid;
+    bad[1] = 'U';
+    REQUIRE_THROWS_AS(binary::decode(bad.data(), i), bad_input&);
+    bad = valid;
+    bad[2] = 1;
+    REQUIRE_THROWS_AS(binary::decode(bad.data(), i), bad_input&);
+    bad = valid;
+    bad[20] = 21; // peak larger than full size
+    REQUIRE_THROWS_AS(binary::decode(bad.data(), i), bad_input&);
+
+    // Reserved bytes must be zero in cancels too, while their side is ignored
+    const std::string cancel = convert("C 1\n");
+    bad = cancel;
+    bad[3] = 1;
+    Status status {};
+    REQUIRE(not binary::decode(bad.data(), i, status));
+    REQUIRE(status.error == Error::IllFormedCancel);
+    bad = cancel;
+    bad[1] = 'X';
+    REQUIRE(binary::decode(bad.data(), i, status));
+
+    // Ids of symbols must be below max_symbols, including the largest one which would wrap around
+    for (const auto& msg : {valid, cancel}) {
+        for (const uint symbol : {uint(binary::max_symbols), uint(0xFFFFFFFF)}) {
+            bad = msg;
+            put32(&bad[4], symbol);
+            status = Status{};
+            REQUIRE(not binary::decode(bad.data(), i, status));
+            REQUIRE(status.error == Error::InvalidSymbol);
+            REQUIRE(i.empty());
+        }
+        bad = msg;
+        put32(&bad[4], uint(binary::max_symbols - 1));
+        binary::decode(bad.data(), i);
+        REQUIRE(i.symbol() == binary::max_symbols - 1);
+    }
+
+    // Last message truncated
+    std::istringstream in(valid + valid.substr(0, 10));
+    std::ostringstream out;
+    BinaryStream st(in, out);
+    REQUIRE(st.read(i));
+    REQUIRE_THROWS_AS(st.read(i), bad_input&);
+    REQUIRE(not st.read(i));
+}
+
+TEST_CASE("binary messages carry id of instrument", "[binary][symbols]") {
+    using namespace smatch;
+    Symbols symbols;
+    const std::string lines[] = {"L B 1 100 10 AAPL", "C 1 MSFT"};
+    char msg[binary::message_size];
+    Input i;
+    uint id = 1;
+    for (const auto& line : lines) {
+        parse(line.data(), line.data() + line.size(), i, &symbols);
+        binary::encode(i, msg);
+        REQUIRE(get32(std::string(msg, sizeof(msg)), 4) == id);
+        binary::decode(msg, i);
+        REQUIRE(i.symbol() == id);
+        ++id;
+    }
+
+    Delta d {Change::Add, Side::Sell, 1, 100, 10, 2};
+    char rec[binary::record_size];
+    binary::encode(d, rec);
+    REQUIRE(get32(std::string(rec, sizeof(rec)), 4) == 2);
+}
@@ -2,228 +2,748 @@
 
 #include "book.hpp"
 
-TEST_CASE("insert and remove orders", "[exceptions][book]") {
-    using namespace smatch;
-    Book book;
-    const Book& cbook = book; // shortcut for 'const_cast<const Book&>(book)'
-
-    REQUIRE(cbook.orders<Side::Buy>().empty());
-    REQUIRE(cbook.orders<Side::Sell>().empty());
-
-    auto& o1 = book.insert(Order{Side::Buy, 1, 1020, 30, 50, 40, true, 0});
-    REQUIRE(o1.side == Side::Buy);
-    REQUIRE(o1.id == 1);
-    REQUIRE(o1.price == 1020);
-    REQUIRE(o1.size == 30);
-    REQUIRE(o1.full == 50);
-    REQUIRE(o1.peak == 40);
-    REQUIRE(o1.add == true);
-    // REQUIRE(o1.match == 0); not subject to testing, it is internal to book
-
-    REQUIRE(not cbook.orders<Side::Buy>().empty());
-    REQUIRE(cbook.orders<Side::Buy>().size() == 1);
-    REQUIRE(cbook.orders<Side::Sell>().empty());
-
-    const auto os1 = cbook.orders<Side::Buy>().begin();
-    REQUIRE(os1->first.price == o1.price);
-    REQUIRE(os1->first.serial == 1);
-    REQUIRE(&os1->second == &o1);
-
-    auto& o2 = book.insert(Order{Side::Buy, 2, 1030, 20, 20, 20, true, 0});
-    REQUIRE(o2.side == Side::Buy);
-    REQUIRE(o2.id == 2);
-    REQUIRE(o2.price == 1030);
-    REQUIRE(o2.size == 20);
-    REQUIRE(o2.full == 20);
-    REQUIRE(o2.peak == 20);
-    REQUIRE(o2.add == true);
-
-    REQUIRE(cbook.orders<Side::Buy>().size() == 2);
-    REQUIRE(cbook.orders<Side::Sell>().empty());
-
-    // New order with more aggressive buy price of 1030 should become the new top order
-    const auto os2 = cbook.orders<Side::Buy>().begin();
-    REQUIRE(os2->first.price == o2.price);
-    REQUIRE(os2->first.serial == 2);
-    REQUIRE(&os2->second == &o2);
-
-    // Iterator to os1 is still valid, and is now the second order from top
-    REQUIRE((++cbook.orders<Side::Buy>().begin()) == os1);
-    REQUIRE(&os1->second == &o1);
-
-    // Insert duplicate order id on same and opposite side
-    REQUIRE_THROWS_AS(book.insert(Order{Side::Buy, 1, 1020, 30, 50, 40, true, 0}), smatch::bad_order_id);
-    REQUIRE_THROWS_AS(book.insert(Order{Side::Sell, 2, 0, 0, 0, 0, false, 0}), smatch::bad_order_id);
-
-    book.remove(1);
-    REQUIRE(cbook.orders<Side::Buy>().size() == 1);
-    REQUIRE(cbook.orders<Side::Sell>().empty());
+#include <algorithm>
+#include <random>
+#include <sstream>
+#include <string>
+
+namespace smatch {
+    // Cannot be in anonymous namespace, or these would not be found by argument-dependent lookup
+    bool operator==(const Order& lh, const Order& rh) {
+        return lh.side == rh.side
+               && lh.id == rh.id
+               && lh.price == rh.price
+               && lh.size == rh.size
+               && lh.full == rh.full
+               && lh.peak == rh.peak
+               && lh.add == rh.add;
+    }
 
-    const auto os2b = cbook.orders<Side::Buy>().begin();
-    REQUIRE(os2b->second.side == Side::Buy);
-    REQUIRE(os2b->second.id == 2);
-    REQUIRE(os2b->second.price == 1030);
-    REQUIRE(os2b->second.size == 20);
-    REQUIRE(&os2b->second == &o2);
+    bool operator==(const Match& lh, const Match& rh) {
+        return lh.buyId == rh.buyId
+               && lh.sellId == rh.sellId
+               && lh.price == rh.price
+               && lh.size == rh.size;
+    }
+}
 
-    // Remove order which was already removed
-    REQUIRE_THROWS_AS(book.remove(1), smatch::bad_order_id);
+namespace {
+    using namespace smatch;
 
-    book.remove(2);
-    REQUIRE(cbook.orders<Side::Buy>().empty());
-    REQUIRE(cbook.orders<Side::Sell>().empty());
+    Order buy(unsigned int id, unsigned int price, unsigned int size) {
+        return Order{Side::Buy, id, price, size, size, size, true, 0};
+    }
 
-    // Add another order, reuse old id (we do not remember ids of removed orders)
-    auto& o3 = book.insert(Order{Side::Sell, 1, 1010, 20, 50, 20, true, 0});
-    REQUIRE(o3.side == Side::Sell);
-    REQUIRE(o3.id == 1);
-    REQUIRE(o3.price == 1010);
-    REQUIRE(o3.size == 20);
-    REQUIRE(o3.full == 50);
-    REQUIRE(o3.peak == 20);
-    REQUIRE(o3.add == true);
+    Order sell(unsigned int id, unsigned int price, unsigned int size) {
+        return Order{Side::Sell, id, price, size, size, size, true, 0};
+    }
 
-    REQUIRE(cbook.orders<Side::Buy>().empty());
-    REQUIRE(cbook.orders<Side::Sell>().size() == 1);
+    template <typename Orders>
+    bool same_orders(const std::vector<Order>& lh, const Orders& rh) {
+        auto i = rh.begin();
+        for (const auto& l : lh){
+            if (i == rh.end())
+                return false;
+            if (not (l == i->second.order()))
+                return false;
+            ++i;
+        }
+        return i == rh.end();
+    }
 
-    // New order is now top of the book, with bumped serial
-    const auto os3 = cbook.orders<Side::Sell>().begin();
-    REQUIRE(os3->first.price == o3.price);
-    REQUIRE(os3->first.serial == 3);
-    REQUIRE(&os3->second == &o3);
+    template <typename Book>
+    void insert_and_remove() {
+        Book book;
+        const Book& cbook = book; // shortcut for 'const_cast<const Book&>(book)'
+
+        REQUIRE(cbook.template orders<Side::Buy>().empty());
+        REQUIRE(cbook.template orders<Side::Sell>().empty());
+
+        auto& o1 = book.insert(Order{Side::Buy, 1, 1020, 30, 50, 40, true, 0});
+        REQUIRE(o1.side == Side::Buy);
+        REQUIRE(o1.id == 1);
+        REQUIRE(o1.price == 1020);
+        REQUIRE(o1.size == 30);
+        REQUIRE(o1.full == 50);
+        REQUIRE(o1.peak == 40);
+        REQUIRE(o1.order().add == true);
+
+        REQUIRE(not cbook.template orders<Side::Buy>().empty());
+        REQUIRE(cbook.template orders<Side::Buy>().size() == 1);
+        REQUIRE(cbook.template orders<Side::Sell>().empty());
+
+        const auto os1 = cbook.template orders<Side::Buy>().begin();
+        REQUIRE(os1->second.price == o1.price);
+        REQUIRE(os1->first.serial == 1);
+        REQUIRE(&os1->second == &o1);
+
+        auto& o2 = book.insert(Order{Side::Buy, 2, 1030, 20, 20, 20, true, 0});
+        REQUIRE(o2.side == Side::Buy);
+        REQUIRE(o2.id == 2);
+        REQUIRE(o2.price == 1030);
+        REQUIRE(o2.size == 20);
+        REQUIRE(o2.full == 20);
+        REQUIRE(o2.peak == 20);
+        REQUIRE(o2.order().add == true);
+
+        REQUIRE(cbook.template orders<Side::Buy>().size() == 2);
+        REQUIRE(cbook.template orders<Side::Sell>().empty());
+
+        // New order with more aggressive buy price of 1030 should become the new top order
+        const auto os2 = cbook.template orders<Side::Buy>().begin();
+        REQUIRE(os2->second.price == o2.price);
+        REQUIRE(os2->first.serial == 2);
+        REQUIRE(&os2->second == &o2);
+
+        // Iterator to os1 is still valid, and is now the second order from top
+        REQUIRE((++cbook.template orders<Side::Buy>().begin()) == os1);
+        REQUIRE(&os1->second == &o1);
+
+        // Insert duplicate order id on same and opposite side
+        REQUIRE_THROWS_AS(book.insert(Order{Side::Buy, 1, 1020, 30, 50, 40, true, 0}), smatch::bad_order_id);
+        REQUIRE_THROWS_AS(book.insert(Order{Side::Sell, 2, 0, 0, 0, 0, false, 0}), smatch::bad_order_id);
+
+        book.remove(1);
+        REQUIRE(cbook.template orders<Side::Buy>().size() == 1);
+        REQUIRE(cbook.template orders<Side::Sell>().empty());
+
+        const auto os2b = cbook.template orders<Side::Buy>().begin();
+        REQUIRE(os2b->second.side == Side::Buy);
+        REQUIRE(os2b->second.id == 2);
+        REQUIRE(os2b->second.price == 1030);
+        REQUIRE(os2b->second.size == 20);
+        REQUIRE(&os2b->second == &o2);
+
+        // Remove order which was already removed
+        REQUIRE_THROWS_AS(book.remove(1), smatch::bad_order_id);
+
+        book.remove(2);
+        REQUIRE(cbook.template orders<Side::Buy>().empty());
+        REQUIRE(cbook.template orders<Side::Sell>().empty());
+
+        // Add another order, reuse old id (we do not remember ids of removed orders)
+        auto& o3 = book.insert(Order{Side::Sell, 1, 1010, 20, 50, 20, true, 0});
+        REQUIRE(o3.side == Side::Sell);
+        REQUIRE(o3.id == 1);
+        REQUIRE(o3.price == 1010);
+        REQUIRE(o3.size == 20);
+        REQUIRE(o3.full == 50);
+        REQUIRE(o3.peak == 20);
+        REQUIRE(o3.order().add == true);
+
+        REQUIRE(cbook.template orders<Side::Buy>().empty());
+        REQUIRE(cbook.template orders<Side::Sell>().size() == 1);
+
+        // New order is now top of the book, with bumped serial
+        const auto os3 = cbook.template orders<Side::Sell>().begin();
+        REQUIRE(os3->second.price == o3.price);
+        REQUIRE(os3->first.serial == 3);
+        REQUIRE(&os3->second == &o3);
+
+        // More orders
+        auto& o4 = book.insert(Order{Side::Sell, 2, 1020, 20, 20, 20, true, 0});
+        REQUIRE(cbook.template orders<Side::Sell>().size() == 2);
+        REQUIRE(cbook.template orders<Side::Buy>().empty());
+
+        auto& o5 = book.insert(Order{Side::Sell, 3, 1000, 20, 20, 20, true, 0});
+        REQUIRE(cbook.template orders<Side::Sell>().size() == 3);
+        REQUIRE(cbook.template orders<Side::Buy>().empty());
+
+        auto os5 = cbook.template orders<Side::Sell>().begin();
+        // This funny notation means "create temporary of the same type as os5 and then increment it"
+        REQUIRE(++(decltype(os5) (os5)) == os3);
+        // Simplar as above, except the temporary is incremented twice
+        auto os4 = ++(++(decltype(os5) (os5)));
+
+        // Most aggressive sell price at top
+        REQUIRE(os5->second.price == 1000);
+        REQUIRE(&os5->second == &o5);
+        REQUIRE(os3->second.price == 1010);
+        REQUIRE(&os3->second == &o3);
+        REQUIRE(os4->second.price == 1020);
+        REQUIRE(&os4->second == &o4);
+    }
 
-    // More orders
-    auto& o4 = book.insert(Order{Side::Sell, 2, 1020, 20, 20, 20, true, 0});
-    REQUIRE(cbook.orders<Side::Sell>().size() == 2);
-    REQUIRE(cbook.orders<Side::Buy>().empty());
+    template <typename Book>
+    void match_buy_orders() {
+        Book book;
+        const Book& cbook = book; // shortcut for 'const_cast<const Book&>(book)'
+
+        const auto& o1 = book.insert(buy(1, 1010, 200));
+        const auto& o2 = book.insert(buy(2, 1010, 200));
+        const auto& o3 = book.insert(buy(3, 1030, 200));
+        const auto& o4 = book.insert(buy(4, 1010, 200));
+        const auto& o5 = book.insert(buy(5, 1000, 200));
+        REQUIRE(cbook.template orders<Side::Buy>().size() == 5);
+
+        // Check sort order of new orders : first by price, then by serial (which coincides with id)
+        std::vector<Order> buys;
+        buys.push_back(Order{Side::Buy, 3, 1030, 200, 200, 200, true, 0});
+        buys.push_back(Order{Side::Buy, 1, 1010, 200, 200, 200, true, 0});
+        buys.push_back(Order{Side::Buy, 2, 1010, 200, 200, 200, true, 0});
+        buys.push_back(Order{Side::Buy, 4, 1010, 200, 200, 200, true, 0});
+        buys.push_back(Order{Side::Buy, 5, 1000, 200, 200, 200, true, 0});
+        REQUIRE(same_orders(buys, cbook.template orders<Side::Buy>()));
+
+        // Replace top order 3 at 1030 with another top order 6 at 1020
+        book.remove(3);
+        buys.erase(buys.begin());
+        REQUIRE(same_orders(buys, cbook.template orders<Side::Buy>()));
+
+        const auto& o6 = book.insert(buy(6, 1020, 200));
+        buys.insert(buys.begin(), Order{Side::Buy, 6, 1020, 200, 200, 200, true, 0});
+        REQUIRE(same_orders(buys, cbook.template orders<Side::Buy>()));
+
+        // Remove order 4 in the middle
+        book.remove(4);
+        auto i = buys.begin();
+        std::advance(i, 3);
+        buys.erase(i);
+        REQUIRE(same_orders(buys, cbook.template orders<Side::Buy>()));
+
+        // Match sell order 7 at 1010
+        auto&& o7 = sell(7, 1010, 450);
+        std::vector<Match> matches;
+        book.template match<Side::Sell>(o7, matches);
+
+        REQUIRE(matches.size() == 3);
+        REQUIRE(matches[0] == (Match{6, 7, 1020, 200, 0}));
+        REQUIRE(matches[1] == (Match{1, 7, 1010, 200, 0}));
+        REQUIRE(matches[2] == (Match{2, 7, 1010, 50, 0}));
+
+        // Only two orders left, of which order 2 is partially filled now
+        buys.clear();
+        buys.push_back(Order{Side::Buy, 2, 1010, 150, 150, 200, true, 0});
+        buys.push_back(Order{Side::Buy, 5, 1000, 200, 200, 200, true, 0});
+        REQUIRE(same_orders(buys, cbook.template orders<Side::Buy>()));
+
+        // Add new top order
+        const auto& o8 = book.insert(buy(8, 1020, 200));
+        buys.insert(buys.begin(), Order{Side::Buy, 8, 1020, 200, 200, 200, true, 0});
+        REQUIRE(same_orders(buys, cbook.template orders<Side::Buy>()));
+
+        // Add second level order at 1010 - must be last at this price level
+        const auto& o9 = book.insert(buy(9, 1010, 200));
+        i = buys.begin();
+        std::advance(i, 2);
+        buys.insert(i, Order{Side::Buy, 9, 1010, 200, 200, 200, true, 0});
+        REQUIRE(same_orders(buys, cbook.template orders<Side::Buy>()));
+
+        // We currently have orders 8, 2, 9 and 5. Check the references are still valid.
+        REQUIRE(buys[0] == o8.order());
+        REQUIRE(buys[1] == o2.order());
+        REQUIRE(buys[2] == o9.order());
+        REQUIRE(buys[3] == o5.order());
+    }
 
-    auto& o5 = book.insert(Order{Side::Sell, 3, 1000, 20, 20, 20, true, 0});
-    REQUIRE(cbook.orders<Side::Sell>().size() == 3);
-    REQUIRE(cbook.orders<Side::Buy>().empty());
+    template <typename Book>
+    void price_levels() {
+        Book book;
+        const Book& cbook = book; // shortcut for 'const_cast<const Book&>(book)'
+        const auto& sells = cbook.template orders<Side::Sell>();
+        REQUIRE(sells.best() == nullptr);
+
+        book.insert(sell(1, 1010, 100));
+        book.insert(sell(2, 1010, 200));
+        book.insert(sell(3, 1020, 300));
+        book.insert(Order{Side::Sell, 4, 1000, 50, 500, 50, true, 0});
+
+        const Level* l = sells.best();
+        REQUIRE(l != nullptr);
+        REQUIRE(l->price == 1000);
+        REQUIRE(l->count == 1);
+        REQUIRE(l->size == 50);
+        REQUIRE(l->head == l->tail);
+        REQUIRE(l->prev == nullptr);
+        l = l->next;
+        REQUIRE(l->price == 1010);
+        REQUIRE(l->count == 2);
+        REQUIRE(l->size == 300);
+        REQUIRE(l->head->second.id == 1);
+        REQUIRE(l->tail->second.id == 2);
+        REQUIRE(l->next->price == 1020);
+        REQUIRE(l->next->next == nullptr);
+
+        // Cancel in the middle of the queue, then the last order at this price
+        book.remove(1);
+        REQUIRE(l->count == 1);
+        REQUIRE(l->size == 200);
+        REQUIRE(l->head->second.id == 2);
+        book.remove(2);
+        REQUIRE(sells.best()->next->price == 1020);
+        REQUIRE(sells.best()->next->prev == sells.best());
+
+        // Partial fill of top iceberg, then its refill is moved to the back of its level
+        book.insert(sell(5, 1000, 100));
+        const Node* const iceberg = sells.best()->head;
+        REQUIRE(iceberg->second.id == 4);
+        REQUIRE(iceberg->first.serial == 4);
+        auto&& o6 = buy(6, 1000, 80);
+        std::vector<Match> matches;
+        book.template match<Side::Buy>(o6, matches);
+        REQUIRE(matches.size() == 2);
+        REQUIRE(matches[0] == (Match{6, 4, 1000, 50, 0}));
+        REQUIRE(matches[1] == (Match{6, 5, 1000, 30, 0}));
+        l = sells.best();
+        REQUIRE(l->count == 2);
+        REQUIRE(l->size == 120);
+        REQUIRE(l->head->second.id == 5);
+        REQUIRE(l->tail->second.id == 4);
+
+        // Refilled iceberg is still the same node, with new serial
+        REQUIRE(l->tail == iceberg);
+        REQUIRE(iceberg->first.serial == 6);
+        REQUIRE(iceberg->second.size == 50);
+        REQUIRE(iceberg->second.full == 450);
+        REQUIRE(book.ids().size() == 3);
+
+        // Refill of the only order at its price level
+        book.remove(5);
+        auto&& o8 = buy(8, 1000, 70);
+        matches.clear();
+        book.template match<Side::Buy>(o8, matches);
+        REQUIRE(matches.size() == 1);
+        REQUIRE(matches[0] == (Match{8, 4, 1000, 70, 0}));
+        REQUIRE(sells.best() == l);
+        REQUIRE(l->count == 1);
+        REQUIRE(l->size == 30);
+        REQUIRE(l->head == iceberg);
+        REQUIRE(iceberg->first.serial == 7);
+        REQUIRE(iceberg->second.full == 380);
+
+        // Fills of an iceberg refilled behind another order, and then refilled again, are one Match. Matches
+        // passed in are left alone.
+        book.insert(sell(9, 1000, 10));
+        auto&& o10 = buy(10, 1000, 120);
+        book.template match<Side::Buy>(o10, matches);
+        REQUIRE(matches.size() == 3);
+        REQUIRE(matches[0] == (Match{8, 4, 1000, 70, 0}));
+        REQUIRE(matches[1] == (Match{10, 4, 1000, 110, 0}));
+        REQUIRE(matches[2] == (Match{10, 9, 1000, 10, 0}));
+        REQUIRE(l->count == 1);
+        REQUIRE(iceberg->second.size == 20);
+        REQUIRE(iceberg->second.full == 270);
+
+        // Iceberg active order fills the same resting order after each refill of its own, still one Match
+        auto&& o11 = Order{Side::Buy, 11, 1000, 5, 15, 5, true, 0};
+        matches.clear();
+        book.template match<Side::Buy>(o11, matches);
+        REQUIRE(matches.size() == 1);
+        REQUIRE(matches[0] == (Match{11, 4, 1000, 15, 0}));
+        REQUIRE(iceberg->second.size == 5);
+
+        // Sweep everything, which removes all levels
+        auto&& o7 = buy(7, 1020, 10000);
+        book.template match<Side::Buy>(o7, matches);
+        REQUIRE(sells.empty());
+        REQUIRE(sells.best() == nullptr);
+        REQUIRE(sells.begin() == sells.end());
+
+        // Many icebergs at one price, each refilled behind all others until filled, still one Match each
+        const uint icebergs = 2000;
+        for (uint id = 100; id < 100 + icebergs; ++id)
+            book.insert(Order{Side::Sell, id, 1000, 1, 3, 1, true, 0});
+        auto&& o12 = buy(12, 1000, 3 * icebergs);
+        matches.clear();
+        book.template match<Side::Buy>(o12, matches);
+        REQUIRE(matches.size() == icebergs);
+        for (uint k = 0; k < icebergs; ++k)
+            REQUIRE(matches[k] == (Match{12, 100 + k, 1000, 3, 0}));
+        REQUIRE(sells.empty());
+    }
 
-    auto os5 = cbook.orders<Side::Sell>().begin();
-    // This funny notation means "create temporary of the same type as os5 and then increment it"
-    REQUIRE(++(decltype(os5) (os5)) == os3);
-    // Simplar as above, except the temporary is incremented twice
-    auto os4 = ++(++(decltype(os5) (os5)));
-
-    // Most aggressive sell price at top
-    REQUIRE(os5->first.price == 1000);
-    REQUIRE(&os5->second == &o5);
-    REQUIRE(os3->first.price == 1010);
-    REQUIRE(&os3->second == &o3);
-    REQUIRE(os4->first.price == 1020);
-    REQUIRE(&os4->second == &o4);
-}
+    template <typename Book>
+    void memory_pools() {
+        Book book;
+        book.reserve(100);
+        REQUIRE(book.pool().capacity() == 100);
+        REQUIRE(book.pool().high_water() == 0);
+
+        for (uint i = 1; i <= 100; ++i)
+            book.insert(i % 2 ? buy(i, 1000 - i, 10) : sell(i, 1100 + i, 10));
+        REQUIRE(book.pool().size() == 100);
+        REQUIRE(book.pool().high_water() == 100);
+        REQUIRE(book.ids().size() == 100);
+        const auto capacity = book.ids().capacity();
+        REQUIRE(capacity >= 100);
+
+        // Freed nodes are reused, so pools do not grow beyond the reserved capacity
+        for (uint i = 1; i <= 50; ++i)
+            book.remove(i);
+        REQUIRE(book.pool().size() == 50);
+        REQUIRE(book.ids().size() == 50);
+        for (uint i = 101; i <= 150; ++i)
+            book.insert(i % 2 ? buy(i, 1000, 10) : sell(i, 1100, 10));
+        REQUIRE(book.pool().size() == 100);
+        REQUIRE(book.pool().capacity() == 100);
+        REQUIRE(book.ids().capacity() == capacity);
+        REQUIRE(book.pool().high_water() == 100);
+
+        // Beyond reserved capacity pools grow
+        book.insert(buy(151, 1000, 10));
+        REQUIRE(book.pool().capacity() > 100);
+        REQUIRE(book.pool().high_water() == 101);
+    }
+    // L2 depth of one side computed by walking individual orders, to compare with the one kept by the book
+    template <Side side, typename Book>
+    std::vector<Depth> walk_depth(const Book& book) {
+        std::vector<Depth> ret;
+        for (const auto& n : book.template orders<side>()) {
+            if (ret.empty() || ret.back().price != n.second.price)
+                ret.push_back(Depth{n.second.price, 0, 0});
+            ++ret.back().count;
+            ret.back().size += n.second.size;
+        }
+        return ret;
+    }
 
-namespace {
-    smatch::Order buy(unsigned int id, unsigned int price, unsigned int size) {
-        return smatch::Order{smatch::Side::Buy, id, price, size, size, size, true, 0};
+    bool same_depth(const std::vector<Depth>& lh, const std::vector<Depth>& rh) {
+        return lh.size() == rh.size() && std::equal(lh.begin(), lh.end(), rh.begin(), [](const Depth& l, const Depth& r) {
+            return l.price == r.price && l.count == r.count && l.size == r.size;
+        });
     }
 
-    smatch::Order sell(unsigned int id, unsigned int price, unsigned int size) {
-        return smatch::Order{smatch::Side::Sell, id, price, size, size, size, true, 0};
+    template <typename Book>
+    void market_data() {
+        Book book;
+        BBO bbo = book.bbo();
+        REQUIRE(bbo.bid.count == 0);
+        REQUIRE(bbo.ask.size == 0);
+
+        book.insert(buy(1, 1000, 10));
+        book.insert(buy(2, 1000, 20));
+        book.insert(buy(3, 990, 5));
+        book.insert(Order{Side::Sell, 4, 1010, 50, 450, 50, true, 0}); // iceberg
+        book.insert(sell(5, 1020, 7));
+        bbo = book.bbo();
+        REQUIRE(bbo.bid.price == 1000);
+        REQUIRE(bbo.bid.count == 2);
+        REQUIRE(bbo.bid.size == 30);
+        REQUIRE(bbo.ask.price == 1010);
+        REQUIRE(bbo.ask.count == 1);
+        REQUIRE(bbo.ask.size == 50); // Only visible size of iceberg
+
+        typename Book::Snapshot snap;
+        book.snapshot(1, snap);
+        REQUIRE(snap.bids.size() == 1);
+        REQUIRE(snap.asks.size() == 1);
+        book.snapshot(10, snap);
+        REQUIRE(snap.bids.size() == 2);
+        REQUIRE(snap.bids[1].price == 990);
+        REQUIRE(snap.asks.size() == 2);
+        REQUIRE(snap.asks[1].size == 7);
+
+        // Partial fill, then removal of the best level
+        auto&& o6 = sell(6, 1000, 15);
+        std::vector<Match> matches;
+        book.template match<Side::Sell>(o6, matches);
+        bbo = book.bbo();
+        REQUIRE(bbo.bid.count == 1);
+        REQUIRE(bbo.bid.size == 15);
+        book.remove(2);
+        REQUIRE(book.bbo().bid.price == 990);
+
+        // Refill of iceberg keeps the level
+        auto&& o7 = buy(7, 1010, 60);
+        matches.clear();
+        book.template match<Side::Buy>(o7, matches);
+        bbo = book.bbo();
+        REQUIRE(bbo.ask.price == 1010);
+        REQUIRE(bbo.ask.count == 1);
+        REQUIRE(bbo.ask.size == 40);
+
+        // Random orders, depth kept by the book is always the same as walking the orders
+        std::mt19937 gen(7);
+        uint id = 100;
+        for (int i = 0; i < 2000; ++i) {
+            const uint price = 990 + gen() % 30;
+            const uint size = 1 + gen() % 50;
+            auto&& o = (gen() % 2 ? buy(++id, price, size) : sell(++id, price, size));
+            if (gen() % 5 == 0) {
+                o.full = size * 4;
+                o.peak = o.size = size;
+            }
+            matches.clear();
+            if (o.side == Side::Buy)
+                book.template match<Side::Buy>(o, matches);
+            else
+                book.template match<Side::Sell>(o, matches);
+            if (o.size > 0)
+                book.insert(o);
+            if (gen() % 3 == 0) {
+                Status st {};
+                book.remove(100 + gen() % (id - 99), st);
+            }
+
+            book.snapshot(1000, snap);
+            REQUIRE(same_depth(snap.bids, walk_depth<Side::Buy>(book)));
+            REQUIRE(same_depth(snap.asks, walk_depth<Side::Sell>(book)));
+        }
     }
+}
 
-    bool operator==(const smatch::Order& lh, const smatch::Order& rh) {
-        return lh.side == rh.side
-               && lh.id == rh.id
-               && lh.price == rh.price
-               && lh.size == rh.size
-               && lh.full == rh.full
-               && lh.peak == rh.peak
-               && lh.add == rh.add;
+namespace {
+    // Random orders, a fifth of them icebergs, with some cancels
+    template <typename Book>
+    void random_orders(Book& book, std::mt19937& gen, uint& id, int count, std::vector<Match>& matches) {
+        for (int i = 0; i < count; ++i) {
+            const uint price = 950 + gen() % 100;
+            const uint size = 1 + gen() % 50;
+            auto&& o = (gen() % 2 ? buy(++id, price, size) : sell(++id, price, size));
+            if (gen() % 5 == 0) {
+                o.full = size * 4;
+                o.peak = o.size = size;
+            }
+            if (o.side == Side::Buy)
+                book.template match<Side::Buy>(o, matches);
+            else
+                book.template match<Side::Sell>(o, matches);
+            if (o.size > 0)
+                book.insert(o);
+            if (gen() % 3 == 0) {
+                Status st {};
+                book.remove(1 + gen() % id, st);
+            }
+        }
     }
 
-    template <smatch::Side side>
-    bool same_orders(const std::vector<smatch::Order>& lh, const decltype((static_cast<const smatch::Book*>(nullptr))->orders<side>())& rh) {
-        auto i = rh.begin();
-        for (const auto& l : lh){
-            if (i == rh.end())
+    template <Side side, typename Lh, typename Rh>
+    bool same_priority(const Lh& lh, const Rh& rh) {
+        auto i = rh.template orders<side>().begin();
+        for (const auto& l : lh.template orders<side>()) {
+            if (i == rh.template orders<side>().end() || l.first.serial != i->first.serial)
                 return false;
-            if (not (l == i->second))
+            if (not (l.second.order() == i->second.order()) || l.level->count != i->level->count)
                 return false;
             ++i;
         }
-        return i == rh.end();
+        return i == rh.template orders<side>().end();
     }
 
-    bool operator==(const smatch::Match& lh, const smatch::Match& rh) {
-        return lh.buyId == rh.buyId
-               && lh.sellId == rh.sellId
-               && lh.price == rh.price
-               && lh.size == rh.size;
+    template <typename Book, typename Restored>
+    void snapshots() {
+        Book book;
+        const Book& cbook = book;
+        std::mt19937 gen(11);
+        uint id = 0;
+        std::vector<Match> m1, m2;
+        random_orders(book, gen, id, 3000, m1);
+        REQUIRE(cbook.template orders<Side::Buy>().size() > 100);
+        REQUIRE(cbook.template orders<Side::Sell>().size() > 100);
+
+        // Snapshot is followed by other data, which is not read by restore()
+        std::stringstream data;
+        book.save(data);
+        data << "tail";
+        Restored restored;
+        const Restored& crestored = restored;
+        restored.restore(data);
+        std::string tail;
+        data >> tail;
+        REQUIRE(tail == "tail");
+
+        REQUIRE(same_priority<Side::Buy>(cbook, crestored));
+        REQUIRE(same_priority<Side::Sell>(cbook, crestored));
+        REQUIRE(crestored.ids().size() == cbook.ids().size());
+        REQUIRE(crestored.pool().size() == cbook.pool().size());
+        typename Book::Snapshot s1;
+        typename Restored::Snapshot s2;
+        book.snapshot(1000, s1);
+        restored.snapshot(1000, s2);
+        REQUIRE(same_depth(s1.bids, s2.bids));
+        REQUIRE(same_depth(s1.asks, s2.asks));
+
+        // Same orders matched, with the same priority, and new orders get serials following the restored ones
+        std::mt19937 gen2 = gen;
+        uint id2 = id;
+        m1.clear();
+        random_orders(book, gen, id, 3000, m1);
+        random_orders(restored, gen2, id2, 3000, m2);
+        REQUIRE(m1.size() == m2.size());
+        REQUIRE(std::equal(m1.begin(), m1.end(), m2.begin()));
+        REQUIRE(same_priority<Side::Buy>(cbook, crestored));
+        REQUIRE(same_priority<Side::Sell>(cbook, crestored));
+
+        // Book must be empty
+        std::stringstream again;
+        book.save(again);
+        REQUIRE_THROWS_AS(restored.restore(again), smatch::exception&);
+
+        // Truncated, inconsistent or not a snapshot at all, leave the book empty
+        const std::string full = again.str();
+        for (const size_t size : {size_t(0), size_t(20), size_t(100), full.size() - 1}) {
+            std::stringstream cut(full.substr(0, size));
+            Restored empty;
+            REQUIRE_THROWS_AS(empty.restore(cut), smatch::exception&);
+            REQUIRE(empty.bbo().bid.count == 0);
+            REQUIRE(empty.bbo().ask.count == 0);
+            REQUIRE(empty.ids().empty());
+            REQUIRE(empty.pool().size() == 0);
+        }
+        for (const size_t at : {size_t(0), size_t(4), size_t(60)}) {
+            std::string bad = full;
+            bad[at] = static_cast<char>(bad[at] + 1);
+            std::stringstream in(bad);
+            Restored empty;
+            REQUIRE_THROWS_AS(empty.restore(in), smatch::exception&);
+            REQUIRE(empty.ids().empty());
+        }
+
+        // Sizes of an iceberg, which must be visible up to its peak, and counts in the header, which must not
+        // reserve more than a limited number of orders until they are read
+        Book one;
+        one.insert(Order{Side::Buy, 1, 1000, 30, 100, 30, true, 0});
+        std::stringstream single;
+        one.save(single);
+        const std::string valid = single.str();
+        const auto patched = [&](size_t at, uint value) {
+            std::string bad = valid;
+            for (size_t i = 0; i < 4; ++i, value >>= 8)
+                bad[at + i] = static_cast<char>(value & 0xFF);
+            return bad;
+        };
+        const size_t peak = 48 + 8 + 20;
+        for (const std::string& bad : {patched(peak, 0), patched(peak, 20), patched(24, 0x7FFFFFFF)}) {
+            std::stringstream in(bad);
+            Restored empty;
+            REQUIRE_THROWS_AS(empty.restore(in), smatch::exception&);
+            REQUIRE(empty.ids().empty());
+            REQUIRE(empty.pool().capacity() <= (1 << 20));
+        }
+        // Peak above full size, as of an order filled past its last refill
+        std::stringstream in(patched(peak, 200));
+        Restored restored2;
+        restored2.restore(in);
+        REQUIRE(restored2.bbo().bid.size == 30);
     }
 }
 
+TEST_CASE("snapshot and restore of book", "[book][snapshot]") {
+    SECTION("map") { snapshots<MapBook, MapBook>(); }
+    SECTION("ladder") { snapshots<LadderBook, LadderBook>(); }
+    SECTION("map to ladder") { snapshots<MapBook, LadderBook>(); }
+}
+
+TEST_CASE("best bid and offer, and depth of price levels", "[book][levels][depth]") {
+    SECTION("map") { market_data<MapBook>(); }
+    SECTION("ladder") { market_data<LadderBook>(); }
+}
+
+TEST_CASE("insert and remove orders", "[exceptions][book]") {
+    SECTION("map") { insert_and_remove<MapBook>(); }
+    SECTION("ladder") { insert_and_remove<LadderBook>(); }
+}
+
 TEST_CASE("matching and sorting of buy orders", "[book][sorting][matching]") {
+    SECTION("map") { match_buy_orders<MapBook>(); }
+    SECTION("ladder") { match_buy_orders<LadderBook>(); }
+}
+
+TEST_CASE("price levels and time priority within level", "[book][levels]") {
+    SECTION("map") { price_levels<MapBook>(); }
+    SECTION("ladder") { price_levels<LadderBook>(); }
+}
+
+TEST_CASE("memory pool for orders and index of ids", "[book][pool]") {
+    SECTION("map") { memory_pools<MapBook>(); }
+    SECTION("ladder") { memory_pools<LadderBook>(); }
+}
+
+TEST_CASE("ladder price band", "[exceptions][book][ladder]") {
     using namespace smatch;
-    Book book;
-    const Book& cbook = book; // shortcut for 'const_cast<const Book&>(book)'
+    // Prices 1000, 1005 ... 1095
+    LadderBook book(1000u, 5u, size_t(20));
+    const LadderBook& cbook = book;
 
-    const auto& o1 = book.insert(buy(1, 1010, 200));
-    const auto& o2 = book.insert(buy(2, 1010, 200));
-    const auto& o3 = book.insert(buy(3, 1030, 200));
-    const auto& o4 = book.insert(buy(4, 1010, 200));
-    const auto& o5 = book.insert(buy(5, 1000, 200));
-    REQUIRE(cbook.orders<Side::Buy>().size() == 5);
+    REQUIRE_THROWS_AS(book.insert(buy(1, 995, 100)), bad_price);
+    REQUIRE_THROWS_AS(book.insert(buy(1, 1002, 100)), bad_price);
+    REQUIRE_THROWS_AS(book.insert(sell(1, 1100, 100)), bad_price);
+    REQUIRE(cbook.orders<Side::Buy>().empty());
+    REQUIRE(cbook.orders<Side::Sell>().empty());
+
+    // Failed inserts above must not leave the id behind
+    REQUIRE_THROWS_AS(book.remove(1), bad_order_id);
+    book.insert(buy(1, 1000, 100));
+    book.insert(buy(2, 1095, 100));
+    book.insert(buy(3, 1050, 100));
+    book.insert(sell(4, 1095, 100));
 
-    // Check sort order of new orders : first by price, then by serial (which coincides with id)
     std::vector<Order> buys;
-    buys.push_back(Order{Side::Buy, 3, 1030, 200, 200, 200, true, 0});
-    buys.push_back(Order{Side::Buy, 1, 1010, 200, 200, 200, true, 0});
-    buys.push_back(Order{Side::Buy, 2, 1010, 200, 200, 200, true, 0});
-    buys.push_back(Order{Side::Buy, 4, 1010, 200, 200, 200, true, 0});
-    buys.push_back(Order{Side::Buy, 5, 1000, 200, 200, 200, true, 0});
-    REQUIRE(same_orders<Side::Buy>(buys, cbook.orders<Side::Buy>()));
-
-    // Replace top order 3 at 1030 with another top order 6 at 1020
+    buys.push_back(buy(2, 1095, 100));
+    buys.push_back(buy(3, 1050, 100));
+    buys.push_back(buy(1, 1000, 100));
+    REQUIRE(same_orders(buys, cbook.orders<Side::Buy>()));
+
+    // Best level is found again after top levels are emptied, from either end of the band
+    book.remove(2);
+    buys.erase(buys.begin());
+    REQUIRE(same_orders(buys, cbook.orders<Side::Buy>()));
     book.remove(3);
     buys.erase(buys.begin());
-    REQUIRE(same_orders<Side::Buy>(buys, cbook.orders<Side::Buy>()));
+    REQUIRE(same_orders(buys, cbook.orders<Side::Buy>()));
+    REQUIRE(cbook.orders<Side::Sell>().begin()->second.id == 4);
+    book.remove(4);
+    REQUIRE(cbook.orders<Side::Sell>().empty());
+    REQUIRE(cbook.orders<Side::Sell>().begin() == cbook.orders<Side::Sell>().end());
+}
 
-    const auto& o6 = book.insert(buy(6, 1020, 200));
-    buys.insert(buys.begin(), Order{Side::Buy, 6, 1020, 200, 200, 200, true, 0});
-    REQUIRE(same_orders<Side::Buy>(buys, cbook.orders<Side::Buy>()));
+TEST_CASE("map and ladder books are equivalent", "[book][ladder][matching]") {
+    using namespace smatch;
+    MapBook map;
+    LadderBook ladder(900u, 1u, size_t(200));
+    const MapBook& cmap = map;
+    const LadderBook& cladder = ladder;
+
+    std::mt19937 gen(42);
+    std::vector<uint> live;
+    std::vector<Match> mm, lm;
+    for (uint id = 1; id < 5000; ++id) {
+        const auto action = gen() % 10;
+        if (action < 2 && not live.empty()) {
+            // Order might have been filled already, in which case both books must reject the cancel
+            const auto i = gen() % live.size();
+            bool filled = false;
+            try { map.remove(live[i]); } catch (const bad_order_id&) { filled = true; }
+            if (filled)
+                REQUIRE_THROWS_AS(ladder.remove(live[i]), bad_order_id);
+            else
+                ladder.remove(live[i]);
+            live.erase(live.begin() + i);
+            continue;
+        }
 
-    // Remove order 4 in the middle
-    book.remove(4);
-    auto i = buys.begin();
-    std::advance(i, 3);
-    buys.erase(i);
-    REQUIRE(same_orders<Side::Buy>(buys, cbook.orders<Side::Buy>()));
-
-    // Match sell order 7 at 1010
-    auto&& o7 = sell(7, 1010, 450);
-    std::vector<Match> matches;
-    book.match<Side::Sell>(o7, matches);
-
-    REQUIRE(matches.size() == 3);
-    REQUIRE(matches[0] == (Match{6, 7, 1020, 200}));
-    REQUIRE(matches[1] == (Match{1, 7, 1010, 200}));
-    REQUIRE(matches[2] == (Match{2, 7, 1010, 50}));
-
-    // Only two orders left, of which order 2 is partially filled now
-    buys.clear();
-    buys.push_back(Order{Side::Buy, 2, 1010, 150, 150, 200, true, 0});
-    buys.push_back(Order{Side::Buy, 5, 1000, 200, 200, 200, true, 0});
-    REQUIRE(same_orders<Side::Buy>(buys, cbook.orders<Side::Buy>()));
-
-    // Add new top order
-    const auto& o8 = book.insert(buy(8, 1020, 200));
-    buys.insert(buys.begin(), Order{Side::Buy, 8, 1020, 200, 200, 200, true, 0});
-    REQUIRE(same_orders<Side::Buy>(buys, cbook.orders<Side::Buy>()));
-
-    // Add second level order at 1010 - must be last at this price level
-    const auto& o9 = book.insert(buy(9, 1010, 200));
-    i = buys.begin();
-    std::advance(i, 2);
-    buys.insert(i, Order{Side::Buy, 9, 1010, 200, 200, 200, true, 0});
-    REQUIRE(same_orders<Side::Buy>(buys, cbook.orders<Side::Buy>()));
-
-    // We currently have orders 8, 2, 9 and 5. Check the references are still valid.
-    REQUIRE(buys[0] == o8);
-    REQUIRE(buys[1] == o2);
-    REQUIRE(buys[2] == o9);
-    REQUIRE(buys[3] == o5);
+        const Side side = (gen() % 2 ? Side::Buy : Side::Sell);
+        const uint price = 950 + gen() % 100;
+        const uint full = 1 + gen() % 500;
+        const uint peak = (action < 4 ? 1 + gen() % full : full);
+        Order m {side, id, price, peak, full, peak, true, 0};
+        Order l = m;
+        mm.clear();
+        lm.clear();
+        if (side == Side::Buy) {
+            map.match<Side::Buy>(m, mm);
+            ladder.match<Side::Buy>(l, lm);
+        }
+        else {
+            map.match<Side::Sell>(m, mm);
+            ladder.match<Side::Sell>(l, lm);
+        }
+        REQUIRE(mm.size() == lm.size());
+        REQUIRE(std::equal(mm.begin(), mm.end(), lm.begin()));
+        REQUIRE(m == l);
+        if (m.size > 0) {
+            map.insert(m);
+            ladder.insert(l);
+            live.push_back(id);
+        }
+    }
+
+    std::vector<Order> orders;
+    for (const auto& o : cmap.orders<Side::Buy>())
+        orders.push_back(o.second.order());
+    REQUIRE(same_orders(orders, cladder.orders<Side::Buy>()));
+    orders.clear();
+    for (const auto& o : cmap.orders<Side::Sell>())
+        orders.push_back(o.second.order());
+    REQUIRE(same_orders(orders, cladder.orders<Side::Sell>()));
 }
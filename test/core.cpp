@@ -1,6 +1,17 @@
 #include "catch.hpp"
 
 #include "runner.hpp"
+#include "mapped.hpp"
+#include "latency.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <random>
+#include <thread>
+
+#include <unistd.h>
 
 TEST_CASE("not infinite loop on empty input", "[core]") {
     using namespace smatch;
@@ -43,6 +54,8 @@ namespace {
         bool report(const smatch::exception&, bool) { return r; }
         void write(const smatch::Match&) { }
         void write(const smatch::Order&) { }
+        void write(const smatch::Delta&) { }
+        void write(const smatch::PriceLevel&) { }
     };
 
     DummyFail2 channel(DummyFail2& d, std::ostream&) { return d; }
@@ -72,6 +85,8 @@ namespace {
         bool report(const smatch::exception&, bool) { return true; }
         void write(const smatch::Match&) { }
         void write(const smatch::Order&) { }
+        void write(const smatch::Delta&) { }
+        void write(const smatch::PriceLevel&) { }
     };
 
     DummyFail3 channel(DummyFail3& d, std::ostream&) { return d; }
@@ -171,3 +186,755 @@ TEST_CASE("parsing bad stream inputs", "[core][parsing]") {
 
     REQUIRE(not s.read(t)); // EOF
 }
+
+TEST_CASE("routine errors are returned in status", "[core][parsing][status]") {
+    using namespace smatch;
+    std::ostringstream dummy;
+    std::istringstream in (
+        "L B 1 100\n" // too few inputs
+        "L S 1 1020 100\n"
+        "C 2\n"
+        "C 1 TOOLONGNAMEOFINSTRUMENT\n"
+        "F B 1 1020 100\n" // unrecognized
+    );
+
+    Symbols symbols;
+    Stream s(in, dummy, Flush::Idle, 1, &symbols);
+    Input t;
+    Status st {};
+    REQUIRE(s.read(t, st));
+    REQUIRE(st.error == Error::IllFormedLimit);
+    REQUIRE(t.empty());
+
+    st = Status{};
+    REQUIRE(s.read(t, st));
+    REQUIRE(st.ok());
+    Engine e;
+    Engine::matches_t m;
+    REQUIRE(not t.handle(e, m, st));
+    REQUIRE(st.ok());
+
+    // Cancel of unknown order
+    REQUIRE(s.read(t, st));
+    REQUIRE(st.ok());
+    REQUIRE(not t.handle(e, m, st));
+    REQUIRE(st.error == Error::InvalidOrderId);
+    REQUIRE(st.id == 2);
+    REQUIRE(std::string(message(st.error)) == "Invalid order id");
+    REQUIRE_THROWS_AS(t.handle(e, m), bad_order_id&);
+
+    // Error of symbol is not replaced by error of cancel
+    st = Status{};
+    REQUIRE(s.read(t, st));
+    REQUIRE(st.error == Error::InvalidSymbol);
+
+    st = Status{};
+    REQUIRE(s.read(t, st));
+    REQUIRE(st.error == Error::UnrecognizedInput);
+    REQUIRE(not s.read(t, st));
+
+    Book b;
+    st = Status{};
+    REQUIRE(not b.remove(1, st));
+    REQUIRE(st.error == Error::InvalidOrderId);
+    REQUIRE(st.id == 1);
+    b.insert(Order{Side::Buy, 1, 100, 10, 10, 10, true, 0});
+    st = Status{};
+    REQUIRE(b.remove(1, st));
+    REQUIRE(st.ok());
+}
+
+namespace {
+    // Only reports status, so bad input and bad order id are never thrown, unless report returns false
+    struct StatusOnly : smatch::Stream {
+        int reported = 0;
+        bool pass = true;
+
+        StatusOnly(std::istream& in, std::ostream& out) : Stream(in, out) {}
+
+        bool report(const smatch::exception&, bool) { throw std::logic_error("Unexpected exception"); }
+        bool report(const smatch::Status&) { ++reported; return pass; }
+    };
+
+    StatusOnly& channel(std::istream&, StatusOnly& d) { return d; }
+}
+
+TEST_CASE("runner reports status of routine errors", "[core][status]") {
+    using namespace smatch;
+    const std::string input =
+        "L S 1 1020 100\n"
+        "X\n"
+        "C 7\n"
+        "L B 2 1020 10\n";
+
+    std::istringstream in(input);
+    std::ostringstream out;
+    {
+        StatusOnly ch {in, out};
+        Engine en;
+        Runner::run(en, in, ch, Runner::Output::Delta);
+        REQUIRE(ch.reported == 2);
+    }
+    REQUIRE(out.str() ==
+        "D A S 1 1020 100\n"
+        "M 2 1 1020 10\n"
+        "D R S 1 1020 90\n");
+
+    // Thrown as before, if the channel wants it
+    std::istringstream in2(input);
+    StatusOnly ch {in2, out};
+    ch.pass = false;
+    Engine en;
+    REQUIRE_THROWS_AS(Runner::run(en, in2, ch), bad_input&);
+}
+
+TEST_CASE("incremental output of changes in the book", "[core][delta]") {
+    using namespace smatch;
+    std::istringstream in (
+        "L B 1 100 10\n"
+        "L S 2 100 5\n"
+        "I S 3 101 30 10\n"
+        "M B 4 15\n"
+        "C 1\n"
+    );
+    std::ostringstream out;
+    Engine en;
+    Runner::run(en, in, out, Runner::Output::Delta);
+    REQUIRE(out.str() ==
+        "D A B 1 100 10\n"
+        "M 1 2 100 5\n"
+        "D R B 1 100 5\n"
+        "D A S 3 101 10\n"
+        "M 4 3 101 15\n"
+        "D F S 3 101 10\n"
+        "D R S 3 101 5\n"
+        "D X B 1 100 0\n"
+    );
+}
+
+namespace {
+    // Collects orders written in full book output, or applies changes written in delta output
+    struct Collect {
+        std::map<smatch::uint, smatch::Order> orders;
+
+        void write(const smatch::Match&) { }
+        void write(const smatch::Order& o) { orders[o.id] = o; }
+        void write(const smatch::Delta& d) {
+            if (d.change == smatch::Change::Remove)
+                orders.erase(d.id);
+            else
+                orders[d.id] = smatch::Order{d.side, d.id, d.price, d.size, 0, 0, true, 0};
+        }
+        void write(const smatch::PriceLevel&) { }
+    };
+}
+
+TEST_CASE("changes in the book replay to the same book", "[core][delta]") {
+    using namespace smatch;
+    std::istringstream in (
+        "L B 1 100 10\n"
+        "I B 2 100 50 10\n"
+        "L B 3 99 20\n"
+        "I S 4 102 60 20\n"
+        "L S 5 101 10\n"
+        "M S 6 35\n"
+        "O B 7 102 45\n"
+        "C 3\n"
+        "L S 8 100 100\n"
+        "I B 9 101 100 30\n"
+        "M B 10 20\n"
+    );
+    std::ostringstream dummy;
+    Stream s(in, dummy);
+    Engine full, delta;
+    delta.record(true);
+    Collect fc, dc;
+    Input i;
+    while (s.read(i)) {
+        fc.orders.clear();
+        Runner::handle(i, full, fc, Runner::Output::Book);
+        Runner::handle(i, delta, dc, Runner::Output::Delta);
+        REQUIRE(fc.orders.size() == dc.orders.size());
+        for (const auto& o : fc.orders) {
+            const auto d = dc.orders.find(o.first);
+            REQUIRE(d != dc.orders.end());
+            REQUIRE(d->second.side == o.second.side);
+            REQUIRE(d->second.price == o.second.price);
+            REQUIRE(d->second.size == o.second.size);
+        }
+    }
+}
+
+TEST_CASE("aggregated output of changed price levels", "[core][levels]") {
+    using namespace smatch;
+    const std::string input =
+        "L B 1 100 10\n"
+        "L B 2 100 5\n"
+        "L B 3 99 7\n"
+        "I S 4 102 100 10\n"
+        "M S 5 12\n"
+        "C 3\n"
+        "L B 6 98 1\n";
+
+    {
+        std::istringstream in(input);
+        std::ostringstream out;
+        Engine en;
+        Runner::run(en, in, out, Runner::Output::Level);
+        REQUIRE(out.str() ==
+            "P B 100 10 1\n"
+            "P B 100 15 2\n"
+            "P B 99 7 1\n"
+            "P S 102 10 1\n"
+            "M 1 5 100 10\n"
+            "M 2 5 100 2\n"
+            "P B 100 3 1\n"
+            "P B 99 0 0\n"
+            "P B 98 1 1\n");
+    }
+
+    // Level moving into the best one is written when the level above is removed, and the one moving out when a
+    // better level is added
+    {
+        std::istringstream in(input + "C 2\nL B 7 101 1\n");
+        std::ostringstream out;
+        Engine en;
+        en.depth(1);
+        Runner::run(en, in, out, Runner::Output::Level);
+        REQUIRE(out.str() ==
+            "P B 100 10 1\n"
+            "P B 100 15 2\n"
+            "P S 102 10 1\n"
+            "M 1 5 100 10\n"
+            "M 2 5 100 2\n"
+            "P B 100 3 1\n"
+            "P B 100 0 0\n"
+            "P B 98 1 1\n"
+            "P B 101 1 1\n"
+            "P B 98 0 0\n");
+    }
+
+    // Sweep of levels with icebergs refilled many times writes each level once
+    {
+        std::istringstream in(
+            "I S 1 100 3 1\n"
+            "I S 2 100 3 1\n"
+            "L S 3 101 2\n"
+            "I S 4 101 4 1\n"
+            "L B 5 99 1\n"
+            "M B 6 9\n");
+        std::ostringstream out;
+        Engine en;
+        Runner::run(en, in, out, Runner::Output::Level);
+        REQUIRE(out.str() ==
+            "P S 100 1 1\n"
+            "P S 100 2 2\n"
+            "P S 101 2 1\n"
+            "P S 101 3 2\n"
+            "P B 99 1 1\n"
+            "M 6 1 100 3\n"
+            "M 6 2 100 3\n"
+            "M 6 3 101 2\n"
+            "M 6 4 101 1\n"
+            "P S 100 0 0\n"
+            "P S 101 1 1\n");
+    }
+}
+
+namespace {
+    // Applies price levels written in aggregated output
+    struct CollectLevels {
+        std::map<std::pair<smatch::Side, smatch::uint>, smatch::PriceLevel> levels;
+
+        void write(const smatch::Match&) { }
+        void write(const smatch::Order&) { }
+        void write(const smatch::Delta&) { }
+        void write(const smatch::PriceLevel& l) {
+            if (l.count == 0)
+                levels.erase(std::make_pair(l.side, l.price));
+            else
+                levels[std::make_pair(l.side, l.price)] = l;
+        }
+
+        bool same(const std::vector<smatch::Depth>& depth, smatch::Side side) const {
+            size_t n = 0;
+            for (const auto& l : levels) {
+                if (l.first.first != side)
+                    continue;
+                const auto d = std::find_if(depth.begin(), depth.end(), [&](const smatch::Depth& d) {
+                    return d.price == l.second.price;
+                });
+                if (d == depth.end() || d->count != l.second.count || d->size != l.second.size)
+                    return false;
+                ++n;
+            }
+            return n == depth.size();
+        }
+    };
+}
+
+TEST_CASE("changed price levels replay to the same depth", "[core][levels]") {
+    using namespace smatch;
+    std::mt19937 gen(11);
+    std::ostringstream ss;
+    for (uint id = 1; id <= 3000; ++id) {
+        const char side = (gen() % 2 ? 'B' : 'S');
+        const uint price = 100 + gen() % 20;
+        switch (gen() % 5) {
+            case 0: ss << "M " << side << ' ' << id << ' ' << 1 + gen() % 50 << '\n'; break;
+            case 1: ss << "I " << side << ' ' << id << ' ' << price << ' ' << 100 << ' ' << 1 + gen() % 20 << '\n'; break;
+            case 2: ss << "C " << 1 + gen() % id << '\n'; break;
+            default: ss << "L " << side << ' ' << id << ' ' << price << ' ' << 1 + gen() % 50 << '\n';
+        }
+    }
+
+    for (const size_t depth : {0, 1, 5}) {
+        std::istringstream in(ss.str());
+        std::ostringstream dummy;
+        Stream s(in, dummy);
+        Engine en;
+        en.record(true);
+        en.depth(depth);
+        CollectLevels cl;
+        Book::Snapshot snap;
+        Input i;
+        Status st {};
+        while (s.read(i, st)) {
+            st = Runner::handle(i, en, cl, Runner::Output::Level);
+            en.book().snapshot(depth == 0 ? 1000 : depth, snap);
+            REQUIRE(cl.same(snap.bids, Side::Buy));
+            REQUIRE(cl.same(snap.asks, Side::Sell));
+        }
+    }
+}
+
+namespace {
+    // Counts calls to flush, with std::stringbuf to store output
+    struct CountFlush : std::stringbuf {
+        int flushes = 0;
+        int sync() override { ++flushes; return 0; }
+    };
+}
+
+TEST_CASE("flush policy of buffered output", "[core][output]") {
+    using namespace smatch;
+    const std::string input =
+        "L B 1 100 10\n"
+        "L S 2 101 10\n"
+        "L S 3 101 10\n";
+    const std::string output =
+        "O B 1 100 10\n"
+        "O B 1 100 10\n"
+        "O S 2 101 10\n"
+        "O B 1 100 10\n"
+        "O S 2 101 10\n"
+        "O S 3 101 10\n";
+
+    const auto run = [&](Flush flush, size_t count) {
+        std::istringstream in(input);
+        CountFlush buf;
+        {
+            std::ostream out(&buf);
+            Stream st(in, out, flush, count);
+            Engine en;
+            Runner::run(en, in, st);
+            REQUIRE(buf.str() == output);
+        }
+        return buf.flushes;
+    };
+
+    // Every run also flushes at the end of input, and in the destructor of Stream
+    // Input from istringstream is idle only when all of it is consumed, i.e. when reading past the last line
+    REQUIRE(run(Flush::Idle, 1) == 1 + 2);
+    // Before each of 3 inputs, and when reading past the last line
+    REQUIRE(run(Flush::Input, 1) == 4 + 2);
+    REQUIRE(run(Flush::Event, 1) == 6 + 2);
+    REQUIRE(run(Flush::Count, 4) == 1 + 2);
+}
+
+TEST_CASE("parsing stream inputs with unusual formatting", "[core][parsing]") {
+    using namespace smatch;
+    std::ostringstream dummy;
+    const std::string longComment = "#" + std::string(200 * 1024, 'x');
+    std::istringstream in (
+        longComment + "\n"
+        "L\tB  1\t\t1020    100\n" // any whitespace between fields
+        "LB 2 1020 100\n" // this is what sscanf accepted, too
+        "L B 3 1020 100 \n" // trailing whitespace
+        "L B 4 1020 100\r\n" // trailing carriage return
+        "L B 5 1020 4294967295\n" // largest possible number
+        "L B 6 1020 4294967296\n" // too large
+        "C 1 2\n" // too many inputs
+        "C 7" // last line without end of line
+    );
+
+    Stream s(in, dummy);
+    Input t;
+    REQUIRE(s.read(t)); // comment longer than input buffer
+    REQUIRE(t.empty());
+
+    REQUIRE(s.read(t));
+    REQUIRE(not t.empty());
+
+    REQUIRE(s.read(t));
+    REQUIRE(not t.empty());
+
+    REQUIRE_THROWS_AS(s.read(t), bad_input); // trailing whitespace
+
+    REQUIRE_THROWS_AS(s.read(t), bad_input); // trailing carriage return
+
+    REQUIRE(s.read(t));
+    REQUIRE(not t.empty());
+
+    REQUIRE_THROWS_AS(s.read(t), bad_input); // too large
+
+    REQUIRE_THROWS_AS(s.read(t), bad_input); // too many inputs
+
+    REQUIRE(s.read(t)); // last line
+    REQUIRE(not t.empty());
+
+    REQUIRE(not s.read(t)); // EOF
+    REQUIRE(not s.read(t)); // still EOF
+}
+
+TEST_CASE("parsing from fields found by line scanner is same as from text", "[core][parsing]") {
+    using namespace smatch;
+    std::string text =
+        "L B 1 1020 100\n"
+        "L\tB  1\t\t1020    100\n"
+        "LB 2 1020 100\n"
+        " L B 3 1020 100\n"
+        "L B 3 1020 100 \n"
+        "L B 4 1020 100\r\n"
+        "L B 5 1020 4294967295\n"
+        "L B 6 1020 4294967296\n"
+        "L B 7 1020 9999999999\n"
+        "L B 8 1020 12345678901\n"
+        "L B 9 0000000001 099999999\n"
+        "L B 10 1020 1x0\n"
+        "L B 11 1020 10/\n"
+        "L B1 1020 100\n"
+        "L U 12 1020 100\n"
+        "L BB 13 1020 100\n"
+        "L B 14 1020 100 ABC\n"
+        "I S 15 1020 100 50\n"
+        "I S 16 1020 50 100\n"
+        "M S 17 200\n"
+        "O B 18 1020 100\n"
+        "C 1\n"
+        "C 1 2\n"
+        "# comment\n"
+        "\n"
+        "F B 1 1020 100\n";
+    std::mt19937 gen(3);
+    for (int i = 0; i < 1000; ++i)
+        text += "L S " + std::to_string(gen()) + ' ' + std::to_string(gen() >> (gen() % 32)) + ' ' + std::to_string(gen() % 1000) + '\n';
+
+    const auto same = [](const Input& lh, const Input& rh) {
+        if (lh.empty() || rh.empty())
+            return lh.empty() == rh.empty();
+        if (const Cancel* c = lh.cancel())
+            return rh.cancel() != nullptr && c->id == rh.cancel()->id && c->symbol == rh.cancel()->symbol;
+        const Order* l = lh.order();
+        const Order* r = rh.order();
+        return r != nullptr && l->side == r->side && l->id == r->id && l->price == r->price && l->size == r->size
+            && l->full == r->full && l->peak == r->peak && l->add == r->add && l->symbol == r->symbol;
+    };
+
+    Symbols symbols;
+    LineScanner lines;
+    const char* p = text.data();
+    size_t count = 0;
+    while (const char* eol = lines.next(p, text.data() + text.size())) {
+        const Fields fields = lines.fields();
+        REQUIRE(fields.known());
+        Input expected, actual;
+        Status es {}, as {};
+        const bool ok = parse(p, eol, expected, es, &symbols);
+        REQUIRE(parse(p, eol, fields, actual, as, &symbols) == ok);
+        REQUIRE(as.error == es.error);
+        REQUIRE(same(actual, expected));
+        p = eol + 1;
+        ++count;
+    }
+    REQUIRE(count == 1026);
+}
+
+TEST_CASE("parsed inputs are matched", "[core][parsing]") {
+    using namespace smatch;
+    std::istringstream in (
+        "L\tS 1  1020 100\n"
+        "I S 2 1010 300 100\n"
+        "O B 3 1020 150\n"
+        "M B 4 10"
+    );
+    std::ostringstream out;
+    Engine en;
+    Runner::run(en, in, out, Runner::Output::Delta);
+    REQUIRE(out.str() ==
+        "D A S 1 1020 100\n"
+        "D A S 2 1010 100\n"
+        "M 3 2 1010 150\n"
+        "D F S 2 1010 100\n"
+        "D R S 2 1010 50\n"
+        "M 4 2 1010 10\n"
+        "D R S 2 1010 40\n"
+    );
+}
+
+TEST_CASE("mapped file input is same as stream input", "[core][mapped]") {
+    using namespace smatch;
+    const std::string input =
+        "L S 1 1020 100\n"
+        "# comment\n"
+        "\n"
+        "I S 2 1010 300 100\n"
+        "L B 3 1000 4294967296\n" // too large
+        "O B 3 1020 150\n"
+        "C 9\n" // invalid order id
+        "M B 4 10"; // last line without end of line
+
+    char path[] = "/tmp/smatch_mappedXXXXXX";
+    const int fd = ::mkstemp(path);
+    REQUIRE(fd >= 0);
+    REQUIRE(::write(fd, input.data(), input.size()) == static_cast<ssize_t>(input.size()));
+    ::close(fd);
+
+    for (const auto output : {Runner::Output::Book, Runner::Output::Delta}) {
+        std::istringstream in(input);
+        std::ostringstream expected;
+        Engine e1;
+        Runner::run(e1, in, expected, output);
+
+        std::ostringstream actual;
+        {
+            Mapped m(path);
+            REQUIRE(m.size() == input.size());
+            Engine e2;
+            Runner::run(e2, m, actual, output);
+        }
+        REQUIRE(not expected.str().empty());
+        REQUIRE(actual.str() == expected.str());
+    }
+    ::unlink(path);
+
+    REQUIRE_THROWS_AS(Mapped(path), smatch::exception);
+}
+
+TEST_CASE("parsing names of instruments", "[core][parsing][symbols]") {
+    using namespace smatch;
+    Symbols symbols;
+    Input t;
+
+    const std::string valid[] = {"L B 1 100 10 AAPL", "C 1\tMSFT", "M S 2 5 AAPL", "I B 3 100 20 10 VOD.L"};
+    for (const auto& line : valid) {
+        // Only accepted if there are symbols to intern names in
+        REQUIRE_THROWS_AS(parse(line.data(), line.data() + line.size(), t), bad_input&);
+        parse(line.data(), line.data() + line.size(), t, &symbols);
+        REQUIRE(not t.empty());
+    }
+    REQUIRE(symbols.size() == 4);
+    REQUIRE(symbols.name(0) == "");
+    REQUIRE(symbols.name(1) == "AAPL");
+    REQUIRE(symbols.name(2) == "MSFT");
+    REQUIRE(symbols.name(3) == "VOD.L");
+
+    const std::string aapl = "L S 1 100 10 AAPL";
+    parse(aapl.data(), aapl.data() + aapl.size(), t, &symbols);
+    REQUIRE(t.symbol() == 1);
+    REQUIRE(t.order()->symbol == 1);
+
+    const std::string none = "L S 1 100 10";
+    parse(none.data(), none.data() + none.size(), t, &symbols);
+    REQUIRE(t.symbol() == 0);
+
+    const std::string invalid[] = {
+        "L B 1 100 10 AAPL ", // trailing whitespace
+        "L B 1 100 10 AAPL MSFT", // too many inputs
+        "L B 1 100 10 9AAPL", // must start with a letter
+        "L B 1 100 10AAPL", // no whitespace before
+        "C 1 2"}; // too many inputs
+    for (const auto& line : invalid)
+        REQUIRE_THROWS_AS(parse(line.data(), line.data() + line.size(), t, &symbols), bad_input&);
+
+    const std::string tooLong = "C 1 ABCDEFGHIJKLMNOPQ";
+    REQUIRE_THROWS_AS(parse(tooLong.data(), tooLong.data() + tooLong.size(), t, &symbols), smatch::exception&);
+    REQUIRE(symbols.size() == 4);
+
+    // Names of the longest size, and names which differ only in trailing zeros, are told apart
+    const std::string names[] = {"ABCDEFGHIJKLMNOP", "ABCDEFGHIJKLMNOQ", "ABCDEFGHIJKLMNO", std::string("AAPL\0", 5)};
+    for (uint id = 4; id < 8; ++id) {
+        const auto& n = names[id - 4];
+        REQUIRE(symbols.intern(n.data(), n.data() + n.size()) == id);
+        REQUIRE(symbols.intern(n.data(), n.data() + n.size()) == id);
+        REQUIRE(symbols.name(id) == n);
+    }
+    REQUIRE(symbols.size() == 8);
+}
+
+TEST_CASE("inputs are routed to the book of their instrument", "[core][symbols]") {
+    using namespace smatch;
+    // Same order ids may be used in different instruments
+    const std::string input =
+        "L S 1 1020 100 AAPL\n"
+        "L S 1 2000 100 MSFT\n"
+        "L S 1 1010 100\n"
+        "L B 2 1020 50 AAPL\n"
+        "C 1 MSFT\n"
+        "C 1 MSFT\n"
+        "L B 2 1020 50\n";
+    std::istringstream in(input);
+
+    SECTION("book") {
+        std::ostringstream out;
+        Symbols symbols;
+        {
+            Stream st(in, out, Flush::Idle, 1, &symbols);
+            MultiEngine en;
+            Runner::run(en, in, st);
+            REQUIRE(en.find(symbols.size()) == nullptr);
+            REQUIRE(en.find(0)->book().orders<Side::Sell>().size() == 1);
+            REQUIRE(en.find(1)->book().orders<Side::Sell>().size() == 1);
+            REQUIRE(en.find(2)->book().orders<Side::Sell>().empty());
+        }
+        REQUIRE(out.str() ==
+            "O S 1 1020 100 AAPL\n"
+            "O S 1 2000 100 MSFT\n"
+            "O S 1 1010 100\n"
+            "M 2 1 1020 50 AAPL\n"
+            "O S 1 1020 50 AAPL\n"
+            "M 2 1 1010 50\n"
+            "O S 1 1010 50\n");
+    }
+
+    SECTION("delta") {
+        std::ostringstream out;
+        Symbols symbols;
+        {
+            Stream st(in, out, Flush::Idle, 1, &symbols);
+            MultiEngine en;
+            Runner::run(en, in, st, Runner::Output::Delta);
+        }
+        REQUIRE(out.str() ==
+            "D A S 1 1020 100 AAPL\n"
+            "D A S 1 2000 100 MSFT\n"
+            "D A S 1 1010 100\n"
+            "M 2 1 1020 50 AAPL\n"
+            "D R S 1 1020 50 AAPL\n"
+            "D X S 1 2000 0 MSFT\n"
+            "M 2 1 1010 50\n"
+            "D R S 1 1010 50\n");
+    }
+}
+
+TEST_CASE("books of engines are constructed with band of prices", "[core][symbols][ladder]") {
+    using namespace smatch;
+    // Prices well above the default band, which only fit a ladder book given this band
+    const Band band {99900, 5, 41};
+    const std::string input =
+        "L S 1 100000 100 AAPL\n"
+        "L B 2 100005 50 AAPL\n"
+        "L B 3 99900 10\n"
+        "L S 4 100100 20 AAPL\n";
+    std::istringstream in(input);
+    std::ostringstream out;
+    Symbols symbols;
+    {
+        Stream st(in, out, Flush::Idle, 1, &symbols);
+        MultiEngine en;
+        en.band(band);
+        Runner::run(en, in, st);
+    }
+    REQUIRE(out.str() ==
+        "O S 1 100000 100 AAPL\n"
+        "M 2 1 100000 50 AAPL\n"
+        "O S 1 100000 50 AAPL\n"
+        "O B 3 99900 10\n"
+        "O S 1 100000 50 AAPL\n"
+        "O S 4 100100 20 AAPL\n");
+
+#ifdef SMATCH_BOOK_LADDER
+    // Prices outside of the band, or between its ticks
+    Engine e(band);
+    Engine::matches_t m;
+    for (const uint price : {99895u, 100105u, 100002u})
+        REQUIRE_THROWS_AS(e.order<Side::Buy>(Order{Side::Buy, 5, price, 10, 10, 10, true, 0}, m), bad_price&);
+#endif
+}
+
+#ifdef SMATCH_LATENCY
+namespace {
+    // Input split in chunks, which become available one at a time after a delay, as if sent with pauses
+    struct Chunked : std::streambuf
+    {
+        std::vector<std::string> chunks;
+        size_t next = 0;
+        std::chrono::milliseconds delay;
+
+        Chunked(std::vector<std::string> chunks, std::chrono::milliseconds delay)
+            : chunks(std::move(chunks)), delay(delay)
+        { }
+
+        int_type underflow() override
+        {
+            if (next == chunks.size())
+                return traits_type::eof();
+            std::this_thread::sleep_for(delay);
+            auto& c = chunks[next++];
+            setg(&c[0], &c[0], &c[0] + c.size());
+            return traits_type::to_int_type(c[0]);
+        }
+    };
+}
+
+TEST_CASE("time waiting for input is not counted in reading of it", "[core][latency]") {
+    using namespace smatch;
+    using namespace std::chrono;
+    const milliseconds delay(200);
+    latency::Histogram& wait = latency::histogram(latency::Stage::Wait);
+    latency::Histogram& read = latency::histogram(latency::Stage::Read);
+    const uint64_t waits = wait.count();
+    const uint64_t reads = read.count();
+
+    Chunked sb({"L S 1 1000 10\n", "L B 2 1000 5\n"}, delay);
+    std::istream in(&sb);
+    std::ostringstream out;
+    Stream st(in, out);
+    Engine en;
+    Runner::run(en, in, st);
+    REQUIRE(out.str() == "O S 1 1000 10\nM 2 1 1000 5\nO S 1 1000 5\n");
+
+    // Each input is available after the delay, but parsed as soon as it is
+    REQUIRE(wait.count() == waits + 2);
+    REQUIRE(read.count() == reads + 2);
+    REQUIRE(wait.max() >= static_cast<uint64_t>(nanoseconds(delay).count()));
+    REQUIRE(read.max() < static_cast<uint64_t>(nanoseconds(delay).count()));
+}
+#endif
+
+TEST_CASE("percentiles of latency histogram", "[core][latency]") {
+    using namespace smatch::latency;
+
+    // Small values are exact, larger ones are within 1%
+    for (uint64_t v : {0ull, 1ull, 255ull, 256ull, 1000ull, 123456789ull, 1ull << 40, ~0ull}) {
+        const uint64_t high = Histogram::highest(Histogram::bucket(v));
+        REQUIRE(high >= v);
+        REQUIRE(high - v <= v / 100);
+    }
+    for (size_t b = 1; b < Histogram::buckets; ++b)
+        REQUIRE(Histogram::bucket(Histogram::highest(b - 1) + 1) == b);
+
+    std::unique_ptr<Histogram> h(new Histogram);
+    REQUIRE(h->count() == 0);
+    REQUIRE(h->percentile(50) == 0);
+    for (uint64_t v = 1; v <= 10000; ++v)
+        h->record(v);
+    REQUIRE(h->count() == 10000);
+    REQUIRE(h->max() == 10000);
+    REQUIRE(h->percentile(0) == 1);
+    REQUIRE(h->percentile(50) >= 5000);
+    REQUIRE(h->percentile(50) <= 5050);
+    REQUIRE(h->percentile(99.9) >= 9990);
+    REQUIRE(h->percentile(99.9) <= 10000);
+    REQUIRE(h->percentile(100) == 10000);
+}
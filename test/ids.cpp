@@ -0,0 +1,80 @@
+#include "catch.hpp"
+
+#include "ids.hpp"
+
+#include <random>
+#include <unordered_map>
+
+TEST_CASE("id index insert, find and erase", "[ids]") {
+    using namespace smatch;
+    IdIndex<int> ids;
+    REQUIRE(ids.empty());
+    REQUIRE(ids.find(1) == nullptr);
+
+    const auto i1 = ids.emplace(1, 10);
+    REQUIRE(i1.second);
+    REQUIRE(*i1.first == 10);
+    REQUIRE(ids.size() == 1);
+
+    // Duplicate key leaves value unchanged
+    const auto i2 = ids.emplace(1, 20);
+    REQUIRE(not i2.second);
+    REQUIRE(*i2.first == 10);
+    REQUIRE(ids.size() == 1);
+
+    int value = 0;
+    REQUIRE(not ids.extract(2, value));
+    REQUIRE(ids.extract(1, value));
+    REQUIRE(value == 10);
+    REQUIRE(ids.empty());
+    REQUIRE(not ids.erase(1));
+
+    // Reserved capacity is not exceeded until that many entries are stored
+    ids.reserve(1000);
+    const auto capacity = ids.capacity();
+    REQUIRE(capacity >= 1000);
+    for (uint i = 0; i < 1000; ++i)
+        ids.emplace(i * 1024, static_cast<int>(i));
+    REQUIRE(ids.capacity() == capacity);
+    for (uint i = 0; i < 1000; ++i) {
+        REQUIRE(ids.find(i * 1024) != nullptr);
+        REQUIRE(*ids.find(i * 1024) == static_cast<int>(i));
+    }
+}
+
+TEST_CASE("id index same as unordered_map", "[ids]") {
+    using namespace smatch;
+    IdIndex<uint> ids;
+    std::unordered_map<uint, uint> map;
+
+    // Small key space, to have plenty of collisions, duplicates and deletions
+    std::mt19937 gen(7);
+    for (int i = 0; i < 100000; ++i) {
+        const uint key = gen() % 5000;
+        if (gen() % 3) {
+            const auto r = ids.emplace(key, i);
+            const auto m = map.emplace(key, i);
+            REQUIRE(r.second == m.second);
+            REQUIRE(*r.first == m.first->second);
+        }
+        else {
+            uint value = 0;
+            const bool found = ids.extract(key, value);
+            const auto m = map.find(key);
+            REQUIRE(found == (m != map.end()));
+            if (found) {
+                REQUIRE(value == m->second);
+                map.erase(m);
+            }
+        }
+        REQUIRE(ids.size() == map.size());
+    }
+
+    for (uint key = 0; key < 5000; ++key) {
+        const auto m = map.find(key);
+        const uint* r = ids.find(key);
+        REQUIRE((r != nullptr) == (m != map.end()));
+        if (r != nullptr)
+            REQUIRE(*r == m->second);
+    }
+}
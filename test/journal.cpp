@@ -0,0 +1,245 @@
+#include "catch.hpp"
+
+#include "runner.hpp"
+#include "binary.hpp"
+#include "journal.hpp"
+
+#include <sstream>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include <csignal>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+    using namespace smatch;
+
+    // Orders of a few instruments, including ill-formed input and errors of orders, which are not matched again
+    const char* const first =
+        "L S 1 1020 100 AAA\n"
+        "L S 2 1010 50\n"
+        "I S 3 1010 300 100 BBB\n"
+        "L B 4 1000 4294967296\n"       // too large
+        "L B 5 1000 70 AAA\n"
+        "C 9\n"                         // invalid order id
+        "O B 6 1015 80 BBB\n"
+        "L S 7 1005 40 CCC\n";
+
+    const char* const second =
+        "M B 8 120 BBB\n"
+        "L B 9 1020 30 AAA\n"
+        "C 5\n"
+        "I B 10 1010 200 60\n"
+        "L S 11 1000 20 CCC\n"
+        "M S 12 500 BBB\n";
+
+    struct Temporary
+    {
+        char path[32] = "/tmp/smatch_journalXXXXXX";
+
+        Temporary()
+        {
+            // Journal of an empty file is created with header
+            const int fd = ::mkstemp(path);
+            REQUIRE(fd >= 0);
+            ::close(fd);
+        }
+
+        ~Temporary() { ::unlink(path); }
+
+        off_t size() const
+        {
+            struct stat st;
+            REQUIRE(::stat(path, &st) == 0);
+            return st.st_size;
+        }
+
+        void append(const std::string& data)
+        {
+            const int fd = ::open(path, O_WRONLY | O_APPEND);
+            REQUIRE(fd >= 0);
+            REQUIRE(::write(fd, data.data(), data.size()) == static_cast<ssize_t>(data.size()));
+            ::close(fd);
+        }
+    };
+
+    // Limits size of files written by this process, so that writing past it fails with EFBIG rather than a signal
+    struct FileSizeLimit
+    {
+        rlimit old;
+        void (*handler)(int);
+
+        explicit FileSizeLimit(rlim_t size)
+        {
+            REQUIRE(::getrlimit(RLIMIT_FSIZE, &old) == 0);
+            handler = std::signal(SIGXFSZ, SIG_IGN);
+            rlimit limit = old;
+            limit.rlim_cur = size;
+            REQUIRE(::setrlimit(RLIMIT_FSIZE, &limit) == 0);
+        }
+
+        ~FileSizeLimit()
+        {
+            ::setrlimit(RLIMIT_FSIZE, &old);
+            std::signal(SIGXFSZ, handler);
+        }
+    };
+
+    Input order(uint id)
+    {
+        const std::string line = "L S " + std::to_string(id) + " 1000 10";
+        Input i;
+        parse(line.data(), line.data() + line.size(), i);
+        return i;
+    }
+
+    // Output of the second part of input, matched after the first part
+    std::string expected(Runner::Output output)
+    {
+        std::istringstream in1(first), in2(second);
+        std::ostringstream dummy, out;
+        Symbols symbols;
+        MultiEngine e;
+        Stream st1(in1, dummy, Flush::Idle, 1, &symbols);
+        Runner::run(e, in1, st1, output);
+        Stream st2(in2, out, Flush::Idle, 1, &symbols);
+        Runner::run(e, in2, st2, output);
+        return out.str();
+    }
+
+    // Matches input with journal, after recovering engines from inputs already in it
+    std::string journaled(const char* path, const std::string& input, Runner::Output output, uint64_t recovered)
+    {
+        std::istringstream in(input);
+        std::ostringstream out;
+        Symbols symbols;
+        MultiEngine e;
+        Journal j(path);
+        REQUIRE(j.recover(e, &symbols) == recovered);
+        Journaled<Stream> st(in, out, Flush::Idle, 1, &symbols);
+        st.journal = &j;
+        Runner::run(e, in, st, output);
+        j.sync();
+        return out.str();
+    }
+}
+
+TEST_CASE("engines recovered from journal continue as if never stopped", "[journal][symbols]") {
+    for (const auto output : {Runner::Output::Book, Runner::Output::Delta, Runner::Output::Level}) {
+        Temporary file;
+        // Well-formed inputs only, and names of AAA, BBB and CCC
+        journaled(file.path, first, output, 0);
+        REQUIRE(file.size() == static_cast<off_t>(Journal::header_size + 10 * Journal::record_size));
+        REQUIRE(journaled(file.path, second, output, 7) == expected(output));
+        REQUIRE(file.size() == static_cast<off_t>(Journal::header_size + 16 * Journal::record_size));
+
+        // Binary input has no names, which are ignored when recovering engines
+        MultiEngine e;
+        Journal j(file.path);
+        REQUIRE(j.recover(e, nullptr) == 13);
+        REQUIRE(j.sequence() == 16);
+        REQUIRE(e.size() == 4);
+        REQUIRE(e.find(3) != nullptr);
+        REQUIRE_THROWS_AS(j.recover(e, nullptr), smatch::exception&);
+    }
+}
+
+TEST_CASE("torn record at the end of journal is discarded", "[journal]") {
+    Temporary file;
+    journaled(file.path, first, Runner::Output::Book, 0);
+    const off_t size = file.size();
+    file.append(std::string(Journal::record_size - 1, 'X'));
+
+    // Appending continues after the last complete record
+    REQUIRE(journaled(file.path, second, Runner::Output::Book, 7) == expected(Runner::Output::Book));
+    REQUIRE(file.size() == size + static_cast<off_t>(6 * Journal::record_size));
+
+    MultiEngine e;
+    Journal j(file.path);
+    REQUIRE(j.recover(e, nullptr) == 13);
+}
+
+TEST_CASE("sync of journal", "[journal]") {
+    Temporary file;
+    {
+        // Nothing to commit, then the background thread must be idle and not hold the journal
+        Journal j(file.path);
+        j.sync();
+        j.sync();
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        REQUIRE(j.sequence() == 0);
+    }
+    {
+        Journal j(file.path);
+        j.append(order(1), nullptr);
+        j.append(order(2), nullptr);
+        j.sync();
+        REQUIRE(file.size() == static_cast<off_t>(Journal::header_size + 2 * Journal::record_size));
+        j.sync();
+        j.append(order(3), nullptr);
+        REQUIRE(j.sequence() == 3);
+    }
+    MultiEngine e;
+    Journal j(file.path);
+    REQUIRE(j.recover(e, nullptr) == 3);
+}
+
+TEST_CASE("sync of journal after failed write", "[journal][exceptions]") {
+    Temporary file;
+    Journal j(file.path);
+    {
+        FileSizeLimit limit(Journal::header_size + 2 * Journal::record_size);
+        for (uint id = 1; id <= 5; ++id)
+            j.append(order(id), nullptr);
+        REQUIRE_THROWS_AS(j.sync(), std::runtime_error&);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    // Error is sticky, and the journal can still be destroyed
+    REQUIRE_THROWS_AS(j.sync(), std::runtime_error&);
+    REQUIRE_THROWS_AS(j.append(order(6), nullptr), std::runtime_error&);
+    REQUIRE(j.sequence() == 5);
+}
+
+TEST_CASE("journal errors", "[journal][exceptions]") {
+    Temporary file;
+    journaled(file.path, first, Runner::Output::Book, 0);
+
+    {
+        // Existing records must be recovered first
+        Journal j(file.path);
+        REQUIRE_THROWS_AS(j.append(order(20), nullptr), std::logic_error&);
+    }
+
+    {
+        // Names must be interned with the same ids as when journaled
+        Symbols symbols;
+        const std::string name = "ZZZ";
+        symbols.intern(name.data(), name.data() + name.size());
+        MultiEngine e;
+        Journal j(file.path);
+        REQUIRE_THROWS_AS(j.recover(e, &symbols), smatch::exception&);
+    }
+
+    // Record with a gap in sequence
+    std::string rec(Journal::record_size, '\0');
+    rec[0] = 100;
+    rec[8] = 'C';
+    file.append(rec);
+    {
+        MultiEngine e;
+        Journal j(file.path);
+        REQUIRE_THROWS_AS(j.recover(e, nullptr), smatch::exception&);
+    }
+
+    // Not a journal
+    Temporary other;
+    other.append("not a journal");
+    REQUIRE_THROWS_AS(Journal(other.path), smatch::exception&);
+}
@@ -0,0 +1,242 @@
+#include "catch.hpp"
+
+#include "pipeline.hpp"
+#include "shards.hpp"
+
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+
+namespace {
+    using namespace smatch;
+
+    std::string generate(unsigned seed, int count)
+    {
+        std::mt19937 gen(seed);
+        std::ostringstream ss;
+        for (int id = 1; id <= count; ++id) {
+            const char side = (gen() % 2 ? 'B' : 'S');
+            const uint price = 100 + gen() % 10;
+            switch (gen() % 6) {
+                case 0: ss << "M " << side << ' ' << id << ' ' << 1 + gen() % 50 << '\n'; break;
+                case 1: ss << "O " << side << ' ' << id << ' ' << price << ' ' << 1 + gen() % 50 << '\n'; break;
+                case 2: ss << "I " << side << ' ' << id << ' ' << price << ' ' << 100 << ' ' << 1 + gen() % 20 << '\n'; break;
+                case 3: ss << "C " << 1 + gen() % id << '\n'; break;
+                default: ss << "L " << side << ' ' << id << ' ' << price << ' ' << 1 + gen() % 50 << '\n';
+            }
+        }
+        return ss.str();
+    }
+
+    // Errors are written to output, so the order of reporting can be checked
+    struct Reporting : TextOutput
+    {
+        bool pass; // Return false from report i.e. rethrow
+
+        Reporting(std::ostream& out, bool pass = false) : TextOutput(out, Flush::Idle, 1), pass(pass)
+        { }
+
+        bool report(const exception& e, bool)
+        {
+            const std::string what = e.what();
+            writer.begin().put('E').put(' ').put(what.data(), what.size()).end();
+            return not pass;
+        }
+    };
+}
+
+TEST_CASE("ring passes all items in order", "[pipeline]") {
+    using namespace smatch;
+    for (const auto wait : {Wait::Spin, Wait::Block}) {
+        Ring<uint64_t> ring(5);
+        REQUIRE(ring.capacity() == 8);
+
+        constexpr uint64_t count = 100000;
+        // Assertions are not thread safe, so only check after join
+        bool pushed = true;
+        std::thread producer([&]() {
+            for (uint64_t i = 1; i <= count; ++i)
+                pushed = pushed && ring.push(std::move(i), wait);
+        });
+        uint64_t sum = 0;
+        for (uint64_t i = 1; i <= count; ++i) {
+            uint64_t v = 0;
+            REQUIRE(ring.pop(v, wait));
+            REQUIRE(v == i);
+            sum += v;
+        }
+        producer.join();
+        REQUIRE(pushed);
+        REQUIRE(sum == count * (count + 1) / 2);
+
+        REQUIRE(ring.empty());
+        uint64_t v = 0;
+        ring.stop();
+        REQUIRE(not ring.pop(v, wait));
+    }
+}
+
+TEST_CASE("pipeline output is same as runner", "[pipeline]") {
+    using namespace smatch;
+    const std::string input = generate(3, 2000);
+    std::ostringstream dummy;
+
+    for (const auto output : {Runner::Output::Book, Runner::Output::Delta, Runner::Output::Level}) {
+        std::istringstream in1(input);
+        std::ostringstream expected;
+        Engine e1;
+        Runner::run(e1, in1, expected, output);
+
+        for (const auto wait : {Wait::Spin, Wait::Block}) {
+            std::istringstream in2(input);
+            std::ostringstream actual;
+            {
+                Stream rd(in2, dummy);
+                TextOutput wr(actual, Flush::Idle, 1);
+                Pipeline p;
+                p.wait = wait;
+                p.capacity = 16; // Make sure that rings are full, at times
+                Engine e2;
+                p.run(e2, rd, wr, output);
+            }
+            REQUIRE(actual.str() == expected.str());
+        }
+    }
+}
+
+TEST_CASE("pipeline reports errors in order", "[pipeline][exceptions]") {
+    using namespace smatch;
+    const std::string input =
+        "L B 1 100 10\n"
+        "X\n"
+        "C 5\n"
+        "L S 2 100 4\n";
+    std::ostringstream dummy;
+
+    {
+        std::istringstream in(input);
+        std::ostringstream out;
+        {
+            Stream rd(in, dummy);
+            Reporting wr(out);
+            Pipeline p;
+            p.wait = Wait::Block;
+            Engine e;
+            p.run(e, rd, wr, Runner::Output::Delta);
+        }
+        REQUIRE(out.str() ==
+            "D A B 1 100 10\n"
+            "E Unrecognized input type\n"
+            "E Invalid order id\n"
+            "M 1 2 100 4\n"
+            "D R B 1 100 6\n");
+    }
+
+    {
+        std::istringstream in(input);
+        std::ostringstream out;
+        Stream rd(in, dummy);
+        Reporting wr(out, true);
+        Pipeline p;
+        p.wait = Wait::Block;
+        Engine e;
+        REQUIRE_THROWS_AS(p.run(e, rd, wr, Runner::Output::Delta), bad_input&);
+    }
+}
+
+TEST_CASE("sharded output is same as runner", "[pipeline][symbols]") {
+    using namespace smatch;
+    // Same orders spread across instruments, with some cancels of orders of the other instruments
+    std::string input;
+    {
+        std::istringstream lines(generate(5, 3000));
+        std::mt19937 gen(7);
+        const char* names[] = {"", " AAA", " BBB", " CCC", " DDD", " EEE", " AAA", " AAA"};
+        for (std::string line; std::getline(lines, line); )
+            input += line + names[gen() % 8] + '\n';
+        input += "X\n";
+    }
+    std::ostringstream dummy;
+
+    for (const auto output : {Runner::Output::Book, Runner::Output::Delta, Runner::Output::Level}) {
+        std::istringstream in1(input);
+        std::ostringstream expected;
+        {
+            Symbols symbols;
+            Stream st(in1, expected, Flush::Idle, 1, &symbols);
+            MultiEngine e1;
+            Runner::run(e1, in1, st, output);
+        }
+
+        for (const size_t count : {1, 2, 4}) {
+          for (const size_t rebalance : {0, 50}) {
+            for (const auto wait : {Wait::Spin, Wait::Block}) {
+                std::istringstream in2(input);
+                std::ostringstream actual;
+                {
+                    Symbols symbols;
+                    Stream rd(in2, dummy, Flush::Idle, 1, &symbols);
+                    TextOutput wr(actual, Flush::Idle, 1, &symbols);
+                    Shards s;
+                    s.wait = wait;
+                    s.capacity = 16;
+                    s.rebalance = rebalance;
+                    std::vector<MultiEngine> e2(count);
+                    s.run(e2, rd, wr, output);
+
+                    // Without rebalancing symbols stay in their initial shard, otherwise they may be anywhere
+                    for (uint symbol = 0; symbol < symbols.size(); ++symbol) {
+                        size_t owners = 0;
+                        for (size_t i = 0; i < count; ++i) {
+                            owners += (e2[i].find(symbol) != nullptr);
+                            if (rebalance == 0)
+                                REQUIRE((e2[i].find(symbol) != nullptr) == (i == Shards::shard(symbol, count)));
+                        }
+                        REQUIRE(owners == 1);
+                    }
+                }
+                REQUIRE(actual.str() == expected.str());
+            }
+          }
+        }
+    }
+}
+
+TEST_CASE("balancer moves cold symbols off the hot shard", "[pipeline][symbols]") {
+    using namespace smatch;
+    Balancer b(2);
+    for (uint s = 0; s < 6; ++s)
+        REQUIRE(b.owner(s) == s % 2);
+
+    // Shard 0 has symbols 0, 2, 4 and shard 1 has 1, 3, 5
+    const uint64_t nanos[] = {1000, 10, 100, 10, 50, 10};
+    for (uint s = 0; s < 6; ++s) {
+        auto& l = b.load(s);
+        l.sent = 10;
+        l.done = 10;
+        l.nanos = nanos[s];
+    }
+    // Symbols 4 and 2 are the coldest on shard 0, with 1150 vs 30 before and 1000 vs 180 after moving them
+    auto moves = b.rebalance();
+    REQUIRE(moves.size() == 2);
+    REQUIRE(moves[0].symbol == 4);
+    REQUIRE(moves[1].symbol == 2);
+    REQUIRE(moves[0].from == 0);
+    REQUIRE(moves[0].to == 1);
+    REQUIRE(b.owner(4) == 1);
+    REQUIRE(b.owner(2) == 1);
+
+    // Nothing more to move, as the only symbol of shard 0 now is a hot one
+    b.load(0).nanos += 1000;
+    REQUIRE(b.rebalance().empty());
+
+    // Queued inputs count too, at the average cost of the symbol
+    b.load(1).sent += 100;
+    b.load(3).sent += 100;
+    b.load(5).sent += 100;
+    moves = b.rebalance();
+    REQUIRE(moves.size() == 1);
+    REQUIRE(moves[0].symbol == 1);
+    REQUIRE(moves[0].to == 0);
+}
@@ -0,0 +1,163 @@
+#include "catch.hpp"
+
+#include "scan.hpp"
+
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+    using namespace smatch;
+
+    std::vector<uint32_t> all_lines(Kernel k, const std::string& s, size_t max)
+    {
+        std::vector<uint32_t> ret;
+        std::vector<uint32_t> eols(max);
+        size_t from = 0;
+        for (;;) {
+            const size_t n = find_lines(k, s.data() + from, s.size() - from, eols.data(), max);
+            for (size_t i = 0; i < n; ++i)
+                ret.push_back(static_cast<uint32_t>(from + eols[i]));
+            if (n < max)
+                return ret;
+            from = ret.back() + 1;
+        }
+    }
+
+    // Bounds of fields of each line, as offsets in s, or no bounds if not known
+    std::vector<std::vector<uint32_t>> all_fields(Kernel k, const std::string& s, size_t max, size_t max_bounds)
+    {
+        std::vector<std::vector<uint32_t>> ret;
+        std::vector<uint32_t> eols(max), lasts(max), bounds(max_bounds);
+        size_t from = 0;
+        for (;;) {
+            const size_t n = find_fields(k, s.data() + from, s.size() - from, eols.data(), lasts.data(), max,
+                                         bounds.data(), max_bounds);
+            for (size_t i = 0; i < n; ++i) {
+                std::vector<uint32_t> line;
+                for (uint32_t j = (i == 0 ? 0 : lasts[i - 1]); lasts[i] != no_fields && j < lasts[i]; ++j)
+                    line.push_back(static_cast<uint32_t>(from + bounds[j]));
+                ret.push_back(line);
+            }
+            if (n == 0)
+                return ret;
+            from += eols[n - 1] + 1;
+        }
+    }
+}
+
+TEST_CASE("find lines", "[scan]") {
+    using namespace smatch;
+    REQUIRE(supported(Kernel::Scalar));
+    REQUIRE(supported(best_kernel()));
+
+    uint32_t eols[4];
+    const std::string s = "L B 1 100 10\n\nC 1\n";
+    REQUIRE(find_lines(s.data(), 0, eols, 4) == 0);
+    REQUIRE(find_lines(s.data(), s.size(), eols, 4) == 3);
+    REQUIRE(eols[0] == 12);
+    REQUIRE(eols[1] == 13);
+    REQUIRE(eols[2] == 17);
+    REQUIRE(find_lines(s.data(), s.size(), eols, 2) == 2);
+    REQUIRE(eols[1] == 13);
+}
+
+TEST_CASE("all kernels find same lines", "[scan]") {
+    using namespace smatch;
+    std::mt19937 gen(7);
+
+    for (int t = 0; t < 200; ++t) {
+        // Various sizes around block boundaries, with short and long lines
+        const size_t size = gen() % 300;
+        const uint denominator = 1 + gen() % 70;
+        std::string s(size, 'x');
+        for (auto& c : s) {
+            if (gen() % denominator == 0)
+                c = '\n';
+        }
+
+        const auto expected = all_lines(Kernel::Scalar, s, 1000);
+        for (const auto k : {Kernel::SSE2, Kernel::AVX2}) {
+            if (not supported(k))
+                continue;
+            for (const size_t max : {1, 3, 64, 1000})
+                REQUIRE(all_lines(k, s, max) == expected);
+        }
+    }
+}
+
+TEST_CASE("find fields", "[scan]") {
+    using namespace smatch;
+    const std::string s = "L B 1 100 10\n\n \tC  1\r\nlast";
+    for (const auto k : {Kernel::Scalar, Kernel::SSE2, Kernel::AVX2}) {
+        if (not supported(k))
+            continue;
+        uint32_t eols[4], lasts[4], bounds[128];
+        REQUIRE(find_fields(k, s.data(), s.size(), eols, lasts, 4, bounds, 128) == 3);
+        REQUIRE(eols[0] == 12);
+        REQUIRE(eols[1] == 13);
+        REQUIRE(eols[2] == 21);
+        REQUIRE(lasts[0] == 10);
+        REQUIRE(lasts[1] == 10);
+        REQUIRE(lasts[2] == 14);
+        const std::vector<uint32_t> expected {0, 1, 2, 3, 4, 5, 6, 9, 10, 12, 16, 17, 19, 20};
+        REQUIRE(std::vector<uint32_t>(bounds, bounds + lasts[2]) == expected);
+
+        // Lines are still found without room for the bounds of their fields
+        REQUIRE(find_fields(k, s.data(), s.size(), eols, lasts, 4, bounds, 4) == 3);
+        REQUIRE(lasts[0] == no_fields);
+        REQUIRE(lasts[2] == no_fields);
+    }
+}
+
+TEST_CASE("all kernels find same fields", "[scan]") {
+    using namespace smatch;
+    std::mt19937 gen(11);
+    const std::string chars = "x1 \t\r\n";
+
+    for (int t = 0; t < 200; ++t) {
+        const size_t size = gen() % 300;
+        std::string s(size, 'x');
+        for (auto& c : s)
+            c = chars[gen() % (gen() % 2 ? 3 : chars.size())];
+
+        const auto expected = all_fields(Kernel::Scalar, s, 1000, 1000);
+        REQUIRE(expected.size() == all_lines(Kernel::Scalar, s, 1000).size());
+        for (const auto k : {Kernel::SSE2, Kernel::AVX2}) {
+            if (not supported(k))
+                continue;
+            for (const size_t max : {1, 3, 64, 1000})
+                REQUIRE(all_fields(k, s, max, 1000) == expected);
+
+            // Bounds are either those expected, or not known
+            const auto some = all_fields(k, s, 1000, 80);
+            REQUIRE(some.size() == expected.size());
+            for (size_t i = 0; i < some.size(); ++i)
+                REQUIRE((some[i] == expected[i] || some[i].empty()));
+        }
+    }
+}
+
+TEST_CASE("line scanner", "[scan]") {
+    using namespace smatch;
+    std::string s;
+    for (int i = 0; i < 1000; ++i)
+        s += std::string(i % 37, 'x') + "\n";
+    s += "last";
+
+    LineScanner lines;
+    const char* p = s.data();
+    const char* const end = s.data() + s.size();
+    size_t count = 0;
+    while (const char* eol = lines.next(p, end)) {
+        REQUIRE(eol - p == static_cast<long>(count % 37));
+        const Fields fields = lines.fields();
+        REQUIRE(fields.known());
+        REQUIRE(fields.count == (count % 37 == 0 ? 0 : 1));
+        p = eol + 1;
+        ++count;
+    }
+    REQUIRE(count == 1000);
+    REQUIRE(not lines.fields().known());
+    REQUIRE(std::string(p, end) == "last");
+}